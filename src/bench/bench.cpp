@@ -0,0 +1,271 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <algorithm> // std::max
+#include <stdio.h> // remove
+
+#include "args.hxx"
+
+#include "../headerfile.hpp"
+#include "../ddsfile.hpp"
+#include "../path.hpp"
+#include "../errors.hpp"
+#include "../common.hpp"
+#include "../cli/shared.hpp"
+
+static const char* HELP_BENCH =
+R"(
+Benchmarks for parsing and writing containers and for the extract and add
+commands. Runs every benchmark once to warm up, then reports the fastest of
+the timed iterations. The synthetic container is the same for the same
+options, so results of different builds can be compared.
+
+Usage: % [options]
+
+Options:
+
+  -h, --help                        Display this help menu
+  -e [entries], --entries=[entries] Number of textures in the container
+                                    (default 1000)
+  -s [size], --texture-size=[size]  Width and height of the textures
+                                    (default 256)
+  -n [count], --iterations=[count]  Timed iterations per benchmark
+                                    (default 5)
+  -f [filter], --filter=[filter]    Only run benchmarks containing this text
+  -d [dir], --dir=[dir]             Existing directory for the temporary
+                                    files (default .)
+  --seed=[seed]                     Seed for the texture data (default 1)
+
+)";
+
+// Writes nothing, used to hide the messages of the commands
+
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override
+    {
+        return c;
+    }
+};
+
+struct BenchOptions
+{
+    size_t entries = 1000;
+    uint32_t texture_size = 256;
+    unsigned iterations = 5;
+    std::string filter;
+    std::string dir = ".";
+    uint64_t seed = 1;
+};
+
+// Uses the generator of the g command with a fixed size and no mip levels
+static PegHeader make_container(const BenchOptions& options)
+{
+    GenerateOptions generate_options;
+    generate_options.entries = options.entries;
+    generate_options.formats = {
+        TextureFormat::PC_DXT1, TextureFormat::PC_DXT5, TextureFormat::PC_8888
+    };
+    generate_options.min_size = options.texture_size;
+    generate_options.max_size = options.texture_size;
+    generate_options.mips = MipMode::None;
+    generate_options.nonpow2 = true;
+    generate_options.seed = options.seed;
+
+    PegHeader header = generate_entries(generate_options);
+    for (size_t entry_i = 0; entry_i < header.entries.size(); entry_i++) {
+        PegEntry& entry = header.entries[entry_i];
+        entry.data.resize(entry.data_size);
+        generate_data(options.seed, entry_i, entry.data);
+    }
+    header.dir_block_size = static_cast<uint32_t>(header.size());
+    return header;
+}
+
+static void run_command(const std::string& name, const std::vector<std::string>& args)
+{
+    NullBuffer null_buffer;
+    std::streambuf* old_buffer = std::cerr.rdbuf(&null_buffer);
+    int status = get_commands().at(name)("srtextool", args.begin(), args.end());
+    std::cerr.rdbuf(old_buffer);
+    if (status != 0) {
+        errormsg() << "Command " << name << " failed with status " << status << std::endl;
+        throw exit_error(status);
+    }
+}
+
+class BenchRunner
+{
+public:
+    explicit BenchRunner(const BenchOptions& options)
+        : m_options(options)
+    {
+        std::cout << std::left << std::setw(24) << "benchmark" << std::right <<
+            std::setw(14) << "ms/iter" << std::setw(12) << "MB/s" <<
+            std::setw(14) << "entries/s" << std::endl;
+    }
+
+    // Times func, bytes and entries are the amount of work of one call
+    void run(const std::string& name, uint64_t bytes, size_t entries,
+        const std::function<void()>& func)
+    {
+        if (name.find(m_options.filter) == std::string::npos) {
+            return;
+        }
+
+        func();
+        double best = 0;
+        for (unsigned iteration = 0; iteration < m_options.iterations; iteration++) {
+            auto start = std::chrono::steady_clock::now();
+            func();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (iteration == 0 || elapsed.count() < best) {
+                best = elapsed.count();
+            }
+        }
+        best = std::max(best, 1e-9);
+
+        std::cout << std::left << std::setw(24) << name << std::right << std::fixed <<
+            std::setprecision(3) << std::setw(14) << best * 1000 <<
+            std::setprecision(1) << std::setw(12) << bytes / best / 1e6 <<
+            std::setprecision(0) << std::setw(14) << entries / best << std::endl;
+    }
+
+private:
+    BenchOptions m_options;
+};
+
+int run_benchmarks(const BenchOptions& options)
+{
+    PegHeader header = make_container(options);
+    size_t entry_count = header.entries.size();
+    uint64_t payload_bytes = 0;
+    for (const PegEntry& entry : header.entries) {
+        payload_bytes += entry.data_size;
+    }
+
+    std::ostringstream header_stream;
+    header.write(header_stream);
+    std::string header_bytes = header_stream.str();
+
+    std::string header_filename = path::join(options.dir, "bench.cpeg_pc");
+    std::string data_filename = get_data_filename(header_filename);
+    BenchRunner runner(options);
+
+    // Header parsing and conversion
+
+    runner.run("header_read", header_bytes.size(), entry_count, [&]() {
+        PegHeader parsed;
+        parsed.read(header_bytes.data(), header_bytes.size());
+    });
+    runner.run("header_write", header_bytes.size(), entry_count, [&]() {
+        std::ostringstream stream;
+        header.write(stream);
+    });
+    runner.run("entry_to_dds", entry_count * DDS_HEADER_SIZE, entry_count, [&]() {
+        for (const PegEntry& entry : header.entries) {
+            volatile uint32_t sink = entry.to_dds().ddspf.flags;
+            (void)sink;
+        }
+    });
+    runner.run("detect_pixelformat", 0, entry_count, [&]() {
+        for (const PegEntry& entry : header.entries) {
+            volatile TextureFormat sink = detect_pixelformat(get_pixelformat(entry.bm_fmt));
+            (void)sink;
+        }
+    });
+
+    // Data file I/O, the written files are used by the commands below
+
+    runner.run("write_datafile", payload_bytes, entry_count, [&]() {
+        PegHeader written = header;
+        write_datafile(data_filename, written);
+        write_headerfile(header_filename, written);
+    });
+    runner.run("read_datafile", payload_bytes, entry_count, [&]() {
+        PegHeader read_header = read_headerfile(header_filename);
+        read_datafile(data_filename, read_header);
+    });
+
+    // Commands
+
+    runner.run("cmd_extract", payload_bytes, entry_count, [&]() {
+        run_command("x", {header_filename, "-o", options.dir});
+    });
+    runner.run("cmd_add", payload_bytes, entry_count, [&]() {
+        run_command("a", {header_filename, "-i", options.dir});
+    });
+
+    // Clean up
+
+    for (const PegEntry& entry : header.entries) {
+        remove(path::join(options.dir, entry.filename + ".dds").c_str());
+    }
+    remove(header_filename.c_str());
+    remove(data_filename.c_str());
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    std::string progname = path::basename(argv[0]);
+    std::vector<std::string> cmdargs(argv + 1, argv + argc);
+
+    args::ArgumentParser parser("");
+    args::HelpFlag help(parser, "help", "", {'h', "help"});
+    args::ValueFlag<size_t> entries_arg(parser, "entries", "", {'e', "entries"}, 1000);
+    args::ValueFlag<uint32_t> texture_size_arg(parser, "size", "", {'s', "texture-size"}, 256);
+    args::ValueFlag<unsigned> iterations_arg(parser, "count", "", {'n', "iterations"}, 5);
+    args::ValueFlag<std::string> filter_arg(parser, "filter", "", {'f', "filter"});
+    args::ValueFlag<std::string> dir_arg(parser, "dir", "", {'d', "dir"}, ".");
+    args::ValueFlag<uint64_t> seed_arg(parser, "seed", "", {"seed"}, 1);
+
+    try {
+        parser.ParseArgs(cmdargs);
+    } catch (args::Help) {
+        std::cout << help_format(HELP_BENCH, progname);
+        return 0;
+    } catch (const args::Error& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << help_format(HELP_BENCH, progname);
+        return 1;
+    }
+
+    BenchOptions options;
+    options.entries = args::get(entries_arg);
+    options.texture_size = args::get(texture_size_arg);
+    options.iterations = std::max(1u, args::get(iterations_arg));
+    options.filter = args::get(filter_arg);
+    options.dir = args::get(dir_arg);
+    options.seed = args::get(seed_arg);
+
+    // The entry count fields of the header are 16 bit
+    if (options.entries == 0 || options.entries > UINT16_MAX) {
+        errormsg() << "Entry count must be between 1 and " << UINT16_MAX << std::endl;
+        return 1;
+    }
+    if (options.texture_size == 0 || options.texture_size > UINT16_MAX) {
+        errormsg() << "Texture size must be between 1 and " << UINT16_MAX << std::endl;
+        return 1;
+    }
+    if (!path::exists(options.dir)) {
+        errormsg() << "Directory doesn't exist: " << options.dir << std::endl;
+        return 1;
+    }
+
+    try {
+        return run_benchmarks(options);
+    } catch (const exit_error& e) {
+        return e.status;
+    } catch (const std::exception& e) {
+        return report_error(e);
+    }
+}
@@ -0,0 +1,261 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h> // memcpy
+#include <type_traits>
+
+// Describes the on-disk layout of a struct as a list of fields, so the
+// reader and writer are generated from a single table. Fields are stored
+// back to back in the order they are listed. When the file has the same byte
+// order as the host every field is a plain memcpy, otherwise the bytes are
+// swapped.
+//
+// Example:
+//   typedef Layout<Foo,
+//       LAYOUT_FIELD(Foo, a),
+//       LAYOUT_FIELD_AS(Foo, format, uint16_t),
+//       LayoutPadding<4>
+//   > FooLayout;
+//   FooLayout::read(foo, buffer, ByteOrder::Little);
+
+enum class ByteOrder
+{
+    Little,
+    Big
+};
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+const ByteOrder HOST_BYTE_ORDER = ByteOrder::Big;
+#else
+const ByteOrder HOST_BYTE_ORDER = ByteOrder::Little;
+#endif
+
+inline uint8_t swap_bytes(uint8_t value)
+{
+    return value;
+}
+
+inline uint16_t swap_bytes(uint16_t value)
+{
+    return static_cast<uint16_t>((value << 8) | (value >> 8));
+}
+
+inline uint32_t swap_bytes(uint32_t value)
+{
+    return ((value & 0x000000FFu) << 24) | ((value & 0x0000FF00u) << 8) |
+        ((value & 0x00FF0000u) >> 8) | ((value & 0xFF000000u) >> 24);
+}
+
+inline uint64_t swap_bytes(uint64_t value)
+{
+    return (static_cast<uint64_t>(swap_bytes(static_cast<uint32_t>(value))) << 32) |
+        swap_bytes(static_cast<uint32_t>(value >> 32));
+}
+
+// Unsigned integer with the same size as T, used to swap any field type
+template<size_t Size> struct SizedUInt;
+template<> struct SizedUInt<1> { typedef uint8_t type; };
+template<> struct SizedUInt<2> { typedef uint16_t type; };
+template<> struct SizedUInt<4> { typedef uint32_t type; };
+template<> struct SizedUInt<8> { typedef uint64_t type; };
+
+template<typename T, bool Swap>
+inline T load_field(const char* data)
+{
+    typedef typename SizedUInt<sizeof(T)>::type raw_type;
+    raw_type raw;
+    memcpy(&raw, data, sizeof(T));
+    if (Swap) {
+        raw = swap_bytes(raw);
+    }
+    T value;
+    memcpy(&value, &raw, sizeof(T));
+    return value;
+}
+
+template<typename T, bool Swap>
+inline void store_field(char* data, T value)
+{
+    typedef typename SizedUInt<sizeof(T)>::type raw_type;
+    raw_type raw;
+    memcpy(&raw, &value, sizeof(T));
+    if (Swap) {
+        raw = swap_bytes(raw);
+    }
+    memcpy(data, &raw, sizeof(T));
+}
+
+// Loads a value in the given byte order from an unaligned buffer position
+template<typename T>
+inline T load_value(const char* data, ByteOrder order)
+{
+    if (order == HOST_BYTE_ORDER) {
+        return load_field<T, false>(data);
+    } else {
+        return load_field<T, true>(data);
+    }
+}
+
+template<typename T>
+inline void store_value(char* data, T value, ByteOrder order)
+{
+    if (order == HOST_BYTE_ORDER) {
+        store_field<T, false>(data, value);
+    } else {
+        store_field<T, true>(data, value);
+    }
+}
+
+
+
+// Scalar member, stored on disk as Storage (e.g. an enum stored as uint16_t)
+template<typename Class, typename Member, Member Class::*Ptr, typename Storage = Member>
+struct LayoutField
+{
+    static const size_t size = sizeof(Storage);
+
+    template<bool Swap>
+    static void read(Class& obj, const char* data)
+    {
+        obj.*Ptr = static_cast<Member>(load_field<Storage, Swap>(data));
+    }
+
+    template<bool Swap>
+    static void write(const Class& obj, char* data)
+    {
+        store_field<Storage, Swap>(data, static_cast<Storage>(obj.*Ptr));
+    }
+};
+
+// Fixed size array member
+template<typename Class, typename Elem, size_t Count, Elem (Class::*Ptr)[Count]>
+struct LayoutArray
+{
+    static const size_t size = sizeof(Elem) * Count;
+
+    template<bool Swap>
+    static void read(Class& obj, const char* data)
+    {
+        for (size_t i = 0; i < Count; i++) {
+            (obj.*Ptr)[i] = load_field<Elem, Swap>(data + i * sizeof(Elem));
+        }
+    }
+
+    template<bool Swap>
+    static void write(const Class& obj, char* data)
+    {
+        for (size_t i = 0; i < Count; i++) {
+            store_field<Elem, Swap>(data + i * sizeof(Elem), (obj.*Ptr)[i]);
+        }
+    }
+};
+
+// Struct member with a layout of its own
+template<typename Class, typename Member, Member Class::*Ptr, typename MemberLayout>
+struct LayoutNested
+{
+    static const size_t size = MemberLayout::size;
+
+    template<bool Swap>
+    static void read(Class& obj, const char* data)
+    {
+        MemberLayout::template read_fields<Swap>(obj.*Ptr, data);
+    }
+
+    template<bool Swap>
+    static void write(const Class& obj, char* data)
+    {
+        MemberLayout::template write_fields<Swap>(obj.*Ptr, data);
+    }
+};
+
+// Unused bytes, skipped when reading and zeroed when writing
+template<size_t Size>
+struct LayoutPadding
+{
+    static const size_t size = Size;
+
+    template<bool Swap, typename Class>
+    static void read(Class&, const char*)
+    {
+
+    }
+
+    template<bool Swap, typename Class>
+    static void write(const Class&, char* data)
+    {
+        memset(data, 0, Size);
+    }
+};
+
+template<typename Class, typename... Fields>
+struct Layout;
+
+template<typename Class>
+struct Layout<Class>
+{
+    static const size_t size = 0;
+
+    template<bool Swap>
+    static void read_fields(Class&, const char*)
+    {
+
+    }
+
+    template<bool Swap>
+    static void write_fields(const Class&, char*)
+    {
+
+    }
+};
+
+template<typename Class, typename First, typename... Rest>
+struct Layout<Class, First, Rest...>
+{
+    typedef Layout<Class, Rest...> rest_layout;
+    static const size_t size = First::size + rest_layout::size;
+
+    template<bool Swap>
+    static void read_fields(Class& obj, const char* data)
+    {
+        First::template read<Swap>(obj, data);
+        rest_layout::template read_fields<Swap>(obj, data + First::size);
+    }
+
+    template<bool Swap>
+    static void write_fields(const Class& obj, char* data)
+    {
+        First::template write<Swap>(obj, data);
+        rest_layout::template write_fields<Swap>(obj, data + First::size);
+    }
+
+    // Reads size bytes from data into obj
+    static void read(Class& obj, const char* data, ByteOrder order)
+    {
+        if (order == HOST_BYTE_ORDER) {
+            read_fields<false>(obj, data);
+        } else {
+            read_fields<true>(obj, data);
+        }
+    }
+
+    // Writes obj as size bytes to data
+    static void write(const Class& obj, char* data, ByteOrder order)
+    {
+        if (order == HOST_BYTE_ORDER) {
+            write_fields<false>(obj, data);
+        } else {
+            write_fields<true>(obj, data);
+        }
+    }
+};
+
+#define LAYOUT_FIELD(cls, member) \
+    LayoutField<cls, decltype(cls::member), &cls::member>
+#define LAYOUT_FIELD_AS(cls, member, storage) \
+    LayoutField<cls, decltype(cls::member), &cls::member, storage>
+#define LAYOUT_ARRAY(cls, member) \
+    LayoutArray<cls, std::remove_extent<decltype(cls::member)>::type, \
+        std::extent<decltype(cls::member)>::value, &cls::member>
+#define LAYOUT_NESTED(cls, member, layout) \
+    LayoutNested<cls, decltype(cls::member), &cls::member, layout>
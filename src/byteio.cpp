@@ -4,6 +4,7 @@
 #include <iostream>
 #include <sstream> // std::stringbuf
 
+#include "binlayout.hpp"
 #include "byteio.hpp"
 
 ByteReader::ByteReader(std::istream& stream) :
@@ -67,12 +68,14 @@ std::string ByteReader::readCString(char delim)
     return buffer.str();
 }
 
+// All values are little endian, independent of the host
+
 template<typename T>
 T ByteReader::read_generic()
 {
-    T value;
-    m_stream.read(reinterpret_cast<char*>(&value), sizeof(T));
-    return value;
+    char buffer[sizeof(T)];
+    m_stream.read(buffer, sizeof(T));
+    return load_value<T>(buffer, ByteOrder::Little);
 }
 
 int64_t ByteReader::readS64()
@@ -197,7 +200,9 @@ void ByteWriter::writeCString(std::string str)
 template<typename T>
 void ByteWriter::write_generic(T value)
 {
-    m_stream.write(reinterpret_cast<char*>(&value), sizeof(T));
+    char buffer[sizeof(T)];
+    store_value<T>(buffer, value, ByteOrder::Little);
+    m_stream.write(buffer, sizeof(T));
 }
 
 void ByteWriter::writeS64(int64_t value)
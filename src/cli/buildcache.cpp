@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <stdio.h> // remove
+
+#include "../fileio.hpp"
+#include "../hash.hpp"
+#include "../path.hpp"
+#include "../errors.hpp"
+#include "../common.hpp"
+#include "../gcc/abi_fix.hpp"
+#include "shared.hpp"
+#include "buildcache.hpp"
+
+// Text file, one record per line with tab separated fields:
+//   srtextool-cache 1
+//   options <options>
+//   container <header size> <header mtime> <data size> <data mtime>
+//   source <size> <mtime> <hash> <texture name> <path>
+static const char* CACHE_SIGNATURE = "srtextool-cache 1";
+
+bool operator==(const FileStamp& a, const FileStamp& b)
+{
+    return a.size == b.size && a.mtime == b.mtime;
+}
+
+bool operator!=(const FileStamp& a, const FileStamp& b)
+{
+    return !(a == b);
+}
+
+FileStamp get_file_stamp(const std::string& filename)
+{
+    FileStamp stamp;
+    stamp.size = path::file_size(filename);
+    stamp.mtime = path::modified_time(filename);
+    return stamp;
+}
+
+std::string get_cache_filename(const std::string& header_filename)
+{
+    return header_filename + ".cache";
+}
+
+static std::vector<std::string> split_fields(const std::string& line)
+{
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t end = line.find('\t', start);
+        fields.push_back(line.substr(start, end - start));
+        if (end == std::string::npos) {
+            return fields;
+        }
+        start = end + 1;
+    }
+}
+
+bool read_build_cache(const std::string& filename, BuildCache& cache)
+{
+    std::ifstream cachefile(filename);
+    if (!cachefile) {
+        return false;
+    }
+
+    BuildCache result;
+    std::string line;
+    if (!std::getline(cachefile, line) || line != CACHE_SIGNATURE) {
+        warnmsg() << "Ignoring cache file with unknown format: " << filename << std::endl;
+        return false;
+    }
+
+    while (std::getline(cachefile, line)) {
+        std::vector<std::string> fields = split_fields(line);
+        std::istringstream values;
+        bool valid;
+        if (fields[0] == "options" && fields.size() == 2) {
+            result.options = fields[1];
+            valid = true;
+        } else if (fields[0] == "container" && fields.size() == 5) {
+            values.str(fields[1] + " " + fields[2] + " " + fields[3] + " " + fields[4]);
+            valid = static_cast<bool>(values >> result.header_stamp.size >>
+                result.header_stamp.mtime >> result.data_stamp.size >> result.data_stamp.mtime);
+        } else if (fields[0] == "input" && fields.size() == 5) {
+            values.str(fields[1] + " " + fields[2] + " " + fields[3] + " " + fields[4]);
+            valid = static_cast<bool>(values >> result.input_header_stamp.size >>
+                result.input_header_stamp.mtime >> result.input_data_stamp.size >>
+                result.input_data_stamp.mtime);
+        } else if (fields[0] == "source" && fields.size() == 6) {
+            CachedSource source;
+            values.str(fields[1] + " " + fields[2] + " " + fields[3]);
+            valid = static_cast<bool>(values >> source.stamp.size >> source.stamp.mtime >>
+                std::hex >> source.hash);
+            source.texture_name = fields[4];
+            result.sources[fields[5]] = source;
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            warnmsg() << "Ignoring invalid cache file: " << filename << std::endl;
+            return false;
+        }
+    }
+
+    cache = std::move(result);
+    return true;
+}
+
+void write_build_cache(const std::string& filename, const BuildCache& cache)
+{
+    std::ofstream cachefile;
+    set_ios_exceptions(cachefile);
+    try {
+        GCC_ABI_WORKAROUND_START
+        cachefile.open(filename, std::ios::out | std::ios::trunc);
+        cachefile << CACHE_SIGNATURE << "\n";
+        cachefile << "options\t" << cache.options << "\n";
+        cachefile << "container\t" << cache.header_stamp.size << "\t" <<
+            cache.header_stamp.mtime << "\t" << cache.data_stamp.size << "\t" <<
+            cache.data_stamp.mtime << "\n";
+        cachefile << "input\t" << cache.input_header_stamp.size << "\t" <<
+            cache.input_header_stamp.mtime << "\t" << cache.input_data_stamp.size << "\t" <<
+            cache.input_data_stamp.mtime << "\n";
+        for (const auto& source : cache.sources) {
+            cachefile << "source\t" << source.second.stamp.size << "\t" <<
+                source.second.stamp.mtime << "\t" << std::hex << source.second.hash <<
+                std::dec << "\t" << source.second.texture_name << "\t" << source.first << "\n";
+        }
+        cachefile.close();
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        warnmsg() << "Failed to write cache file: " << filename << std::endl;
+        cachefile.close();
+        remove(filename.c_str());
+    }
+}
+
+uint64_t hash_file(const std::string& filename)
+{
+    MappedFile file(filename);
+    return hash_data(file.data(), file.size());
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+
+// Sidecar file of the add command that remembers which source files the
+// textures of a container were built from. Sources with the same size and
+// modification time, or the same content hash, don't need to be read again.
+
+struct FileStamp
+{
+    int64_t size = -1; // -1 if the file doesn't exist
+    int64_t mtime = -1;
+};
+
+bool operator==(const FileStamp& a, const FileStamp& b);
+bool operator!=(const FileStamp& a, const FileStamp& b);
+
+FileStamp get_file_stamp(const std::string& filename);
+
+struct CachedSource
+{
+    std::string texture_name;
+    FileStamp stamp;
+    uint64_t hash = 0;
+};
+
+struct BuildCache
+{
+    std::string options; // Add options that change how sources get converted
+    FileStamp header_stamp; // Container files as they were written
+    FileStamp data_stamp;
+    FileStamp input_header_stamp; // Input container of -o builds, else the same
+    FileStamp input_data_stamp;
+    std::map<std::string, CachedSource> sources; // Indexed by source path
+};
+
+std::string get_cache_filename(const std::string& header_filename);
+
+// Returns false if the file doesn't exist or isn't a valid cache
+bool read_build_cache(const std::string& filename, BuildCache& cache);
+// Failing to write the cache only prints a warning
+void write_build_cache(const std::string& filename, const BuildCache& cache);
+
+// Hashes the content of a file, throws io_error if it can't be read
+uint64_t hash_file(const std::string& filename);
@@ -4,19 +4,66 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <stdexcept> // std::runtime_error
+#include <algorithm> // std::transform
+#include <iterator> // std::make_move_iterator
+#include <ctype.h> // tolower
 
 #include "args.hxx"
 
 #include "../headerfile.hpp"
 #include "../ddsfile.hpp"
+#include "../texture.hpp"
+#include "../tgafile.hpp"
+#include "../mipmap.hpp"
 #include "../path.hpp"
+#include "../stats.hpp"
 #include "../errors.hpp"
 #include "../common.hpp"
 #include "../gcc/abi_fix.hpp"
 #include "shared.hpp"
+#include "workers.hpp"
+#include "buildcache.hpp"
 
-void update_files(const std::vector<std::string>& dds_filenames, PegHeader& header);
-size_t get_file_size(std::istream& stream);
+struct DDSFile
+{
+    DDSHeader header;
+    std::vector<char> data;
+};
+
+// A file to add. DDS data is copied as is unless it has to be encoded to
+// the format of the existing entry, TGA images are always encoded.
+struct SourceFile
+{
+    std::string texture_name;
+    DDSFile dds;
+    std::vector<Image> levels; // Decoded images, only set if they get encoded
+};
+
+struct AddOptions
+{
+    EncodeQuality quality = EncodeQuality::Normal;
+    bool gen_mips = false;
+    bool convert_to_existing = false;
+    MipFilter mip_filter = MipFilter::Box;
+    unsigned jobs = 1;
+};
+
+void update_files(const std::vector<std::string>& filenames, PegHeader& header,
+    const AddOptions& options);
+std::vector<std::string> skip_unchanged(const std::vector<std::string>& filenames,
+    const PegHeader& header, BuildCache& cache, std::vector<CachedSource>& changed,
+    unsigned jobs);
+std::string get_texture_name(const std::string& filename);
+SourceFile read_source_file(const std::string& filename);
+DDSFile read_dds_file(const std::string& dds_filename);
+Image read_tga_file(const std::string& tga_filename);
+std::vector<char> encode_levels(const std::vector<Image>& levels, TextureFormat fmt,
+    EncodeQuality quality, unsigned jobs);
+std::vector<Image> generate_mips(const Image& base, MipFilter filter, bool srgb,
+    unsigned jobs);
+void warn_changes(const PegEntry& entry, TextureFormat fmt, uint32_t width,
+    uint32_t height, uint32_t mip_levels);
 
 const size_t FOURCC_SIZE = 4;
 
@@ -24,6 +71,23 @@ static const char* HELP_ADD =
 R"(
 Adds textures to a container or updates them if they already exist.
 
+DDS files are added as they are. TGA files, and A8R8G8B8 DDS files that
+replace a DXT texture, are encoded to the format of the existing texture.
+New textures from TGA files become DXT1, or DXT5 if they have alpha.
+With --convert-to-existing every DDS file with a different format than the
+texture it replaces is converted, including all of its mip levels.
+
+With --gen-mips the mip levels are made from the base level of every file,
+down to 1x1. Textures without the BM_F_LINEAR_COLOR_SPACE flag are filtered
+in linear light.
+
+With --cache the size, modification time and hash of every file is stored
+in a .cache file next to the header. The next update with --cache skips the
+files that didn't change, and writes nothing at all if no file changed. The
+cache is dropped when the container or the options changed in between. With
+-o the cache is kept next to the output header and the previous output is
+updated instead of the input, as long as the input didn't change.
+
 Usage: % [options] <header> [files...]
 
 Options:
@@ -32,8 +96,26 @@ Options:
   -o [output], --output=[output]    Directory to write the new container to
   -i [input], --input=[input]       Directory to update all existing textures
                                     from
+  -j [jobs], --jobs=[jobs]          Number of threads for reading and
+                                    encoding files, 0 for one per CPU
+                                    (default 1)
+  -q [quality], --quality=[quality] DXT encoding quality: fast, normal or
+                                    high (default normal)
+  -m, --gen-mips                    Replace the mip levels of the files with
+                                    a complete chain made from the base level
+  --mip-filter=[filter]             Filter for --gen-mips: box or kaiser
+                                    (default box)
+  --convert-to-existing             Convert DDS files to the format of the
+                                    texture they replace
+  -p, --patch                       Append textures to the existing data
+                                    file instead of rebuilding it. The space
+                                    of the old data is left unused
+  --dedup                           Store textures with identical data only
+                                    once in the rebuilt data file
+  --cache                           Skip files that didn't change since the
+                                    last update with --cache
   header                            Header file ending with cvbm_pc or cpeg_pc
-  files                             Files to add or update
+  files                             DDS or TGA files to add or update
 
 )";
 
@@ -48,6 +130,14 @@ int cmd_add(std::string progname,
     args::PositionalList<std::string> files_arg(parser, "files", "");
     args::ValueFlag<std::string> output_arg(parser, "output", "", {'o', "output"});
     args::ValueFlag<std::string> input_arg(parser, "input", "", {'i', "input"});
+    args::ValueFlag<unsigned> jobs_arg(parser, "jobs", "", {'j', "jobs"}, 1);
+    args::Flag patch_arg(parser, "patch", "", {'p', "patch"});
+    args::Flag dedup_arg(parser, "dedup", "", {"dedup"});
+    args::Flag cache_arg(parser, "cache", "", {"cache"});
+    args::ValueFlag<std::string> quality_arg(parser, "quality", "", {'q', "quality"}, "normal");
+    args::Flag gen_mips_arg(parser, "gen-mips", "", {'m', "gen-mips"});
+    args::ValueFlag<std::string> mip_filter_arg(parser, "mip-filter", "", {"mip-filter"}, "box");
+    args::Flag convert_arg(parser, "convert-to-existing", "", {"convert-to-existing"});
 
     try {
         parser.ParseArgs(beginargs, endargs);
@@ -77,6 +167,43 @@ int cmd_add(std::string progname,
         std::cerr << help_format(HELP_ADD, progname);
         return 1;
     }
+    if (patch_arg && output_arg) {
+        errormsg() << "Can't use patch and output argument at the same time" << std::endl;
+        std::cerr << help_format(HELP_ADD, progname);
+        return 1;
+    }
+    if (patch_arg && dedup_arg) {
+        errormsg() << "Can't use patch and dedup argument at the same time" << std::endl;
+        std::cerr << help_format(HELP_ADD, progname);
+        return 1;
+    }
+
+    AddOptions options;
+    options.jobs = args::get(jobs_arg);
+    options.gen_mips = args::get(gen_mips_arg);
+    options.convert_to_existing = args::get(convert_arg);
+
+    std::string quality_name = args::get(quality_arg);
+    if (quality_name == "fast") {
+        options.quality = EncodeQuality::Fast;
+    } else if (quality_name == "normal") {
+        options.quality = EncodeQuality::Normal;
+    } else if (quality_name == "high") {
+        options.quality = EncodeQuality::High;
+    } else {
+        errormsg() << "Unknown quality: " << quality_name << std::endl;
+        return 1;
+    }
+
+    std::string mip_filter_name = args::get(mip_filter_arg);
+    if (mip_filter_name == "box") {
+        options.mip_filter = MipFilter::Box;
+    } else if (mip_filter_name == "kaiser") {
+        options.mip_filter = MipFilter::Kaiser;
+    } else {
+        errormsg() << "Unknown mip filter: " << mip_filter_name << std::endl;
+        return 1;
+    }
 
     std::string header_in_filename = args::get(header_arg);
     std::string data_in_filename = get_data_filename(header_in_filename);
@@ -100,116 +227,328 @@ int cmd_add(std::string progname,
     }
 
     PegHeader header;
+    bool patch = args::get(patch_arg);
+    // Container the unchanged textures are copied from
+    std::string base_data_filename = data_in_filename;
 
     if (path::exists(header_in_filename)) {
         try {
             header = read_headerfile(header_in_filename);
-            read_datafile(data_in_filename, header);
         } catch (const exit_error& e) {
             return e.status;
+        } catch (const std::exception& e) {
+            return report_error(e);
         }
     } else {
         infomsg() << "Input file does not exist, creating a new one" << std::endl;
+        patch = false;
     }
 
-    std::vector<std::string> dds_filenames;
+    std::vector<std::string> filenames;
     if (files_arg) {
-        dds_filenames = args::get(files_arg);
+        filenames = args::get(files_arg);
     } else {
+        // Prefer DDS files, texture names already end with .tga
         std::string input_dir = args::get(input_arg);
         for (const PegEntry& entry : header.entries) {
             std::string filename = path::join(input_dir, entry.filename + ".dds");
-            dds_filenames.push_back(filename);
+            std::string tga_filename = path::join(input_dir, entry.filename);
+            if (!path::exists(filename) && path::extension(tga_filename) == "tga" &&
+                    path::exists(tga_filename)) {
+                filename = tga_filename;
+            }
+            filenames.push_back(filename);
         }
     }
 
-    try {
-        update_files(dds_filenames, header);
+    // Skip files that didn't change since the cache was written. The cache
+    // only applies if the input and output containers are still the ones
+    // they were then. With -o the cached textures are only in the output, so
+    // it's updated in place of the unchanged input.
+
+    bool use_cache = args::get(cache_arg);
+    std::string cache_filename = get_cache_filename(header_out_filename);
+    BuildCache cache;
+    std::vector<CachedSource> changed_sources;
+    if (use_cache) {
+        std::string options_key = "quality=" + quality_name +
+            " gen-mips=" + (options.gen_mips ? "1" : "0") +
+            " mip-filter=" + mip_filter_name +
+            " convert-to-existing=" + (options.convert_to_existing ? "1" : "0") +
+            " dedup=" + (args::get(dedup_arg) ? "1" : "0");
+        bool cache_valid = read_build_cache(cache_filename, cache) &&
+            cache.options == options_key &&
+            cache.input_header_stamp == get_file_stamp(header_in_filename) &&
+            cache.input_data_stamp == get_file_stamp(data_in_filename) &&
+            cache.header_stamp == get_file_stamp(header_out_filename) &&
+            cache.data_stamp == get_file_stamp(data_out_filename);
+        if (!cache_valid) {
+            cache = BuildCache();
+        }
+        cache.options = options_key;
+
+        if (cache_valid && header_out_filename != header_in_filename) {
+            try {
+                header = read_headerfile(header_out_filename);
+            } catch (const exit_error& e) {
+                return e.status;
+            } catch (const std::exception& e) {
+                return report_error(e);
+            }
+            base_data_filename = data_out_filename;
+        }
 
-        write_datafile(data_out_filename, header);
-        write_headerfile(header_out_filename, header);
+        filenames = skip_unchanged(filenames, header, cache, changed_sources, options.jobs);
+        if (filenames.empty() && cache_valid) {
+            infomsg() << "All textures are up to date" << std::endl;
+            write_build_cache(cache_filename, cache);
+            return 0;
+        }
+    }
+
+    try {
+        update_files(filenames, header, options);
+
+        // Patching only appends to the data file, the old header stays valid
+        // until the commit replaces it
+        ContainerCommit commit(header_out_filename);
+        if (patch) {
+            patch_datafile(data_out_filename, header);
+            commit.add_appended_file(data_out_filename);
+        } else {
+            write_datafile(commit.add_file(data_out_filename), header, base_data_filename,
+                args::get(dedup_arg));
+        }
+        write_headerfile(commit.add_file(header_out_filename), header);
+        commit.commit();
     } catch (const exit_error& e) {
         return e.status;
+    } catch (const std::exception& e) {
+        return report_error(e);
+    }
+
+    if (use_cache) {
+        for (size_t file_i = 0; file_i < filenames.size(); file_i++) {
+            cache.sources[filenames[file_i]] = changed_sources[file_i];
+        }
+        cache.header_stamp = get_file_stamp(header_out_filename);
+        cache.data_stamp = get_file_stamp(data_out_filename);
+        cache.input_header_stamp = get_file_stamp(header_in_filename);
+        cache.input_data_stamp = get_file_stamp(data_in_filename);
+        write_build_cache(cache_filename, cache);
     }
 
     return 0;
 }
 
-void update_files(const std::vector<std::string>& dds_filenames, PegHeader& header)
+// Removes the files that have the same size and modification time or the
+// same content hash as in the cache, as long as their texture still exists.
+// The new cache records of the remaining files are returned in changed.
+
+std::vector<std::string> skip_unchanged(const std::vector<std::string>& filenames,
+    const PegHeader& header, BuildCache& cache, std::vector<CachedSource>& changed,
+    unsigned jobs)
+{
+    std::vector<CachedSource> current(filenames.size());
+    std::vector<char> unchanged(filenames.size(), 0);
+    parallel_for(filenames.size(), jobs, [&](size_t file_i) {
+        const std::string& filename = filenames[file_i];
+        CachedSource& source = current[file_i];
+        source.texture_name = get_texture_name(filename);
+        source.stamp = get_file_stamp(filename);
+
+        auto cached = cache.sources.find(filename);
+        bool known = (cached != cache.sources.end()) &&
+            (cached->second.texture_name == source.texture_name) &&
+            (cached->second.stamp.size == source.stamp.size) &&
+            (header.entry_index(source.texture_name) != SIZE_MAX);
+        if (known && cached->second.stamp.mtime == source.stamp.mtime) {
+            source.hash = cached->second.hash;
+            unchanged[file_i] = 1;
+            return;
+        }
+
+        // Missing files are reported when they get read
+        if (source.stamp.size < 0) {
+            return;
+        }
+        try {
+            source.hash = hash_file(filename);
+        } catch (const std::exception&) {
+            return;
+        }
+        unchanged[file_i] = known && (source.hash == cached->second.hash);
+    });
+
+    std::vector<std::string> changed_filenames;
+    size_t skipped = 0;
+    for (size_t file_i = 0; file_i < filenames.size(); file_i++) {
+        if (unchanged[file_i]) {
+            cache.sources[filenames[file_i]] = current[file_i];
+            skipped++;
+        } else {
+            changed_filenames.push_back(filenames[file_i]);
+            changed.push_back(current[file_i]);
+        }
+    }
+    if (skipped > 0) {
+        infomsg() << "Skipping " << skipped << " unchanged files" << std::endl;
+    }
+    return changed_filenames;
+}
+
+void update_files(const std::vector<std::string>& filenames, PegHeader& header,
+    const AddOptions& options)
 {
-    for (const std::string& dds_filename : dds_filenames) {
+    // Read and validate all files in parallel
+
+    std::vector<SourceFile> source_files(filenames.size());
+    std::vector<std::string> errors(filenames.size());
+    {
+        ScopedTimer timer(StatPhase::ReadSources);
+        parallel_for(filenames.size(), options.jobs, [&](size_t file_i) {
+            try {
+                source_files[file_i] = read_source_file(filenames[file_i]);
+            } catch (const std::exception& e) {
+                errors[file_i] = e.what();
+            }
+        });
+    }
+
+    bool failed = false;
+    for (const std::string& error : errors) {
+        if (!error.empty()) {
+            errormsg() << error << std::endl;
+            failed = true;
+        }
+    }
+    if (failed) {
+        throw exit_error(1);
+    }
 
-        std::string texture_name = path::remove_extension(path::basename(dds_filename));
+    // Merge into the header in input order
 
-        PegEntry entry;
+    for (SourceFile& source_file : source_files) {
+        DDSFile& dds_file = source_file.dds;
+        const DDSHeader& dds_header = dds_file.header;
+        const std::string& texture_name = source_file.texture_name;
 
         // Check if entry with the same name already exists
 
         size_t existing_index = header.entry_index(texture_name);
         bool is_new = (existing_index == SIZE_MAX);
         if (is_new) {
-            entry.filename = texture_name;
+            PegEntry new_entry;
+            new_entry.filename = texture_name;
+            header.add_entry(std::move(new_entry));
+            existing_index = header.entries.size() - 1;
+        }
+
+        PegEntry& entry = header.entries.at(existing_index);
+        if (is_new) {
             infomsg() << "Adding " << entry.filename << std::endl;
         } else {
-            entry = header.entries.at(existing_index);
             infomsg() << "Updating " << entry.filename << std::endl;
         }
 
-        // Open DDS file
-
-        std::ifstream ddsfile;
-        set_ios_exceptions(ddsfile);
-        try {
-            GCC_ABI_WORKAROUND_START
-            ddsfile.open(dds_filename, OPENMODE_READ);
-            GCC_ABI_WORKAROUND_END
-        } catch (std::ios::failure) {
-            errormsg() << "Failed to open DDS file: " << dds_filename << std::endl;
-            throw exit_error(1);
+        // Uncompressed DDS data replacing a compressed texture gets encoded,
+        // with --convert-to-existing any DDS data in a different format.
+        // Other DDS files are decoded for new mips, but keep their base level.
+
+        TextureFormat dds_format = detect_pixelformat(dds_header.ddspf);
+        bool is_compressed = (entry.bm_fmt == TextureFormat::PC_DXT1 ||
+            entry.bm_fmt == TextureFormat::PC_DXT3 || entry.bm_fmt == TextureFormat::PC_DXT5);
+        bool convert_dds = source_file.levels.empty() && !is_new && dds_format != entry.bm_fmt &&
+            (options.convert_to_existing || (is_compressed && dds_format == TextureFormat::PC_8888));
+        bool keep_dds_format = source_file.levels.empty() && !convert_dds && options.gen_mips;
+        std::vector<char> base_data;
+
+        if (convert_dds || keep_dds_format) {
+            ScopedTimer timer(StatPhase::Decode);
+            PegEntry dds_entry;
+            try {
+                dds_entry.update_dds(dds_header);
+                dds_entry.data_size = static_cast<uint32_t>(dds_file.data.size());
+                dds_entry.data = std::move(dds_file.data);
+                source_file.levels = decode_texture(dds_entry);
+            } catch (const std::exception& e) {
+                errormsg() << "Failed to decode DDS file: " << e.what() << std::endl;
+                throw exit_error(1);
+            }
+            if (keep_dds_format) {
+                size_t base_size = static_cast<size_t>(
+                    calc_level_size(dds_format, dds_header.width, dds_header.height));
+                base_data.assign(dds_entry.data.begin(), dds_entry.data.begin() + base_size);
+            }
         }
 
-        // Read header and texture data
+        if (!source_file.levels.empty()) {
+            std::vector<Image>& levels = source_file.levels;
+            bool has_alpha = image_has_alpha(levels[0]);
 
-        DDSHeader dds_header;
-        try {
-            GCC_ABI_WORKAROUND_START
-            dds_header.read(ddsfile);
-
-            size_t data_size = get_file_size(ddsfile) - DDS_HEADER_SIZE - FOURCC_SIZE;
-            entry.data_size = static_cast<uint32_t>(data_size);
-            entry.data.resize(data_size);
-            ddsfile.read(entry.data.data(), data_size);
-            ddsfile.close();
-            GCC_ABI_WORKAROUND_END
-        } catch (std::ios::failure) {
-            errormsg() << "Failed to read DDS file: " << get_stream_error(ddsfile) << std::endl;
-            throw exit_error(1);
-        } catch (const std::exception& e) {
-            errormsg() << "Failed to read DDS file: " << e.what() << std::endl;
-            throw exit_error(1);
-        }
-
-        // Detect format change
+            TextureFormat target_format = entry.bm_fmt;
+            if (keep_dds_format) {
+                target_format = dds_format;
+            } else if (is_new) {
+                target_format = has_alpha ? TextureFormat::PC_DXT5 : TextureFormat::PC_DXT1;
+            }
+            if (!can_encode_format(target_format)) {
+                errormsg() << "Can't encode " << entry.filename << " as " <<
+                    get_format_name(target_format) << std::endl;
+                throw exit_error(1);
+            }
 
-        if (!is_new) {
-            TextureFormat dds_format = detect_pixelformat(dds_header.ddspf);
-            if (dds_format != entry.bm_fmt) {
-                warnmsg() << "New texture format doesn't match previous format" << std::endl;
-                warnmsg() << "Switching from " << get_format_name(entry.bm_fmt) <<
-                    " to " << get_format_name(dds_format) << std::endl;
+            if (options.gen_mips) {
+                infomsg() << "Generating mip levels for " << entry.filename << std::endl;
+                bool srgb = !(entry.flags & BM_F_LINEAR_COLOR_SPACE);
+                levels = generate_mips(levels[0], options.mip_filter, srgb, options.jobs);
+            }
+            if (!is_new) {
+                warn_changes(entry, target_format, levels[0].width, levels[0].height,
+                    static_cast<uint32_t>(levels.size()));
             }
 
-            if ((dds_header.width != entry.width) || (dds_header.height != entry.height)) {
-                warnmsg() << "Changing dimensions from " <<
-                    entry.width << "x" << entry.height << " to " <<
-                    dds_header.width << "x" << dds_header.height << std::endl;
+            uint32_t width = levels[0].width;
+            uint32_t height = levels[0].height;
+            size_t level_count = levels.size();
+            if (base_data.empty()) {
+                infomsg() << "Encoding " << entry.filename << " as " <<
+                    get_format_name(target_format) << std::endl;
+                entry.data = encode_levels(levels, target_format, options.quality, options.jobs);
+            } else {
+                // Only the new mips need encoding
+                std::vector<Image> mips(std::make_move_iterator(levels.begin() + 1),
+                    std::make_move_iterator(levels.end()));
+                std::vector<char> mip_data = encode_levels(mips, target_format,
+                    options.quality, options.jobs);
+                entry.data = std::move(base_data);
+                entry.data.insert(entry.data.end(), mip_data.begin(), mip_data.end());
+            }
+            entry.data_size = static_cast<uint32_t>(entry.data.size());
+            entry.mapped_data = nullptr;
+            entry.width = static_cast<uint16_t>(width);
+            entry.height = static_cast<uint16_t>(height);
+            entry.bm_fmt = target_format;
+            entry.mip_levels = static_cast<uint8_t>(level_count);
+            if (is_new && has_alpha) {
+                entry.flags |= BM_F_ALPHA;
             }
 
-            if (dds_header.mipmap_count != entry.mip_levels) {
-                warnmsg() << "Changing mip level from " <<
-                    static_cast<int>(entry.mip_levels) << " to " <<
-                    dds_header.mipmap_count << std::endl;
+            bool pow2 = ((entry.width & (entry.width - 1)) == 0) &&
+                ((entry.height & (entry.height - 1)) == 0);
+            if (pow2) {
+                entry.flags &= ~BM_F_NONPOW2;
+            } else {
+                entry.flags |= BM_F_NONPOW2;
             }
+            continue;
+        }
+
+        // Detect format change
+
+        if (!is_new) {
+            warn_changes(entry, dds_format, dds_header.width, dds_header.height,
+                dds_header.mipmap_count);
         }
 
         // Convert header
@@ -221,23 +560,158 @@ void update_files(const std::vector<std::string>& dds_filenames, PegHeader& head
             throw exit_error(1);
         }
 
-        // Insert new header and texture
+        // Replace texture data without copying it
 
-        if (is_new) {
-            header.add_entry(std::move(entry));
-        } else {
-            header.entries.at(existing_index) = std::move(entry);
-        }
+        entry.data_size = static_cast<uint32_t>(dds_file.data.size());
+        entry.data = std::move(dds_file.data);
+        entry.mapped_data = nullptr;
+    }
+}
+
+void warn_changes(const PegEntry& entry, TextureFormat fmt, uint32_t width,
+    uint32_t height, uint32_t mip_levels)
+{
+    if (fmt != entry.bm_fmt) {
+        warnmsg() << "New texture format doesn't match previous format" << std::endl;
+        warnmsg() << "Switching from " << get_format_name(entry.bm_fmt) <<
+            " to " << get_format_name(fmt) << std::endl;
+    }
+
+    if ((width != entry.width) || (height != entry.height)) {
+        warnmsg() << "Changing dimensions from " <<
+            entry.width << "x" << entry.height << " to " <<
+            width << "x" << height << std::endl;
+    }
+
+    if (mip_levels != entry.mip_levels) {
+        warnmsg() << "Changing mip level from " <<
+            static_cast<int>(entry.mip_levels) << " to " <<
+            mip_levels << std::endl;
+    }
+}
+
+// Builds the levels one after the other, with the tiles of each level in parallel
+std::vector<Image> generate_mips(const Image& base, MipFilter filter, bool srgb,
+    unsigned jobs)
+{
+    ScopedTimer timer(StatPhase::Mipmaps);
+    MipGenerator generator(base, filter, srgb);
+    for (size_t level_i = 1; level_i < generator.level_count(); level_i++) {
+        size_t tile_count = generator.begin_level(level_i);
+        parallel_for(tile_count, jobs, [&](size_t tile_i) {
+            generator.filter_tile(tile_i);
+        });
     }
+    return generator.finish();
 }
 
-size_t get_file_size(std::istream& stream)
+// Encodes the tiles of all levels in parallel
+std::vector<char> encode_levels(const std::vector<Image>& levels, TextureFormat fmt,
+    EncodeQuality quality, unsigned jobs)
 {
-    size_t current_pos;
-    current_pos = stream.tellg();
-    stream.seekg(0, std::ios::end);
-    size_t end_pos = stream.tellg();
-    stream.seekg(current_pos);
+    ScopedTimer timer(StatPhase::Encode);
+    TextureEncoder encoder(levels, fmt, quality);
+    parallel_for(encoder.tile_count(), jobs, [&](size_t tile_i) {
+        encoder.encode_tile(tile_i);
+    });
+    return std::move(encoder.data());
+}
+
+// Checks the extension without regard to case
+static bool is_tga_filename(const std::string& filename)
+{
+    std::string extension = path::extension(filename);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == "tga";
+}
+
+// TGA files are named like the texture, DDS files have .dds appended
+std::string get_texture_name(const std::string& filename)
+{
+    if (is_tga_filename(filename)) {
+        return path::basename(filename);
+    }
+    return path::remove_extension(path::basename(filename));
+}
+
+SourceFile read_source_file(const std::string& filename)
+{
+    SourceFile source_file;
+    source_file.texture_name = get_texture_name(filename);
+    if (is_tga_filename(filename)) {
+        source_file.levels.push_back(read_tga_file(filename));
+    } else {
+        source_file.dds = read_dds_file(filename);
+    }
+    return source_file;
+}
+
+DDSFile read_dds_file(const std::string& dds_filename)
+{
+    // Open DDS file, starting at the end to get the size without seeking
+
+    std::ifstream ddsfile;
+    set_ios_exceptions(ddsfile);
+    try {
+        GCC_ABI_WORKAROUND_START
+        ddsfile.open(dds_filename, OPENMODE_READ | std::ios::ate);
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw std::runtime_error("Failed to open DDS file: " + dds_filename);
+    }
+
+    // Read header and texture data
+
+    DDSFile dds_file;
+    try {
+        GCC_ABI_WORKAROUND_START
+        size_t file_size = static_cast<size_t>(ddsfile.tellg());
+        ddsfile.seekg(0);
+        dds_file.header.read(ddsfile);
+
+        size_t data_size = file_size - DDS_HEADER_SIZE - FOURCC_SIZE;
+        dds_file.data.resize(data_size);
+        ddsfile.read(dds_file.data.data(), data_size);
+        ddsfile.close();
+        add_counter(StatCounter::BytesRead, file_size);
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw std::runtime_error("Failed to read DDS file " + dds_filename + ": " +
+            get_stream_error(ddsfile));
+    } catch (const std::exception& e) {
+        throw std::runtime_error("Failed to read DDS file " + dds_filename + ": " +
+            e.what());
+    }
+
+    return dds_file;
+}
+
+Image read_tga_file(const std::string& tga_filename)
+{
+    std::ifstream tgafile;
+    set_ios_exceptions(tgafile);
+    try {
+        GCC_ABI_WORKAROUND_START
+        tgafile.open(tga_filename, OPENMODE_READ);
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw std::runtime_error("Failed to open TGA file: " + tga_filename);
+    }
+
+    Image image;
+    try {
+        GCC_ABI_WORKAROUND_START
+        image = read_tga(tgafile);
+        add_counter(StatCounter::BytesRead, static_cast<uint64_t>(tgafile.tellg()));
+        tgafile.close();
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw std::runtime_error("Failed to read TGA file " + tga_filename + ": " +
+            get_stream_error(tgafile));
+    } catch (const std::exception& e) {
+        throw std::runtime_error("Failed to read TGA file " + tga_filename + ": " +
+            e.what());
+    }
 
-    return end_pos;
+    return image;
 }
@@ -0,0 +1,190 @@
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+
+#include "args.hxx"
+
+#include "../errors.hpp"
+#include "../common.hpp"
+#include "../gcc/abi_fix.hpp"
+#include "shared.hpp"
+#include "workers.hpp"
+
+struct BatchJob
+{
+    size_t line_number;
+    std::string line;
+    std::vector<std::string> args;
+};
+
+std::vector<BatchJob> read_jobs(std::istream& stream);
+
+static const char* HELP_BATCH =
+R"(
+Runs many commands from a job file in one process. The jobs and the textures
+inside them share one pool of threads.
+
+Usage: % [options] <jobfile>
+
+Options:
+
+  -h, --help                        Display this help menu
+  -j [jobs], --jobs=[jobs]          Number of threads, 0 for one per CPU
+                                    (default 0)
+  jobfile                           File with one command per line, - to
+                                    read from stdin
+
+Each line is a command like it would be passed to the program, for example
+"x professorgenki.cpeg_pc -o extracted". Arguments are separated by spaces,
+double quotes group arguments that contain spaces. Empty lines and lines
+starting with # are skipped. Jobs run in no particular order, so a job file
+shouldn't change the same container twice. The -j option of the jobs
+themselves is ignored.
+
+)";
+
+int cmd_batch(std::string progname,
+    std::vector<std::string>::const_iterator beginargs,
+    std::vector<std::string>::const_iterator endargs)
+{
+    std::string job_progname = progname;
+    progname += " b";
+    args::ArgumentParser parser("");
+    args::HelpFlag help(parser, "help", "", {'h', "help"});
+    args::Positional<std::string> jobfile_arg(parser, "jobfile", "");
+    args::ValueFlag<unsigned> jobs_arg(parser, "jobs", "", {'j', "jobs"}, 0);
+
+    try {
+        parser.ParseArgs(beginargs, endargs);
+    } catch (args::Help) {
+        std::cerr << help_format(HELP_BATCH, progname);
+        return 0;
+    } catch (const args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << help_format(HELP_BATCH, progname);
+        return 1;
+    } catch (const args::ValidationError& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!jobfile_arg) {
+        std::cerr << help_format(HELP_BATCH, progname);
+        return 1;
+    }
+
+    // Read job file
+
+    std::string jobfile_filename = args::get(jobfile_arg);
+    std::vector<BatchJob> jobs;
+    if (jobfile_filename == "-") {
+        jobs = read_jobs(std::cin);
+    } else {
+        std::ifstream jobfile(jobfile_filename);
+        if (!jobfile.is_open()) {
+            errormsg() << "Failed to open job file: " << jobfile_filename << std::endl;
+            return 1;
+        }
+        jobs = read_jobs(jobfile);
+    }
+
+    // Look up all commands before starting anything
+
+    const std::unordered_map<std::string, commandtype>& commands = get_commands();
+    for (const BatchJob& job : jobs) {
+        const std::string& name = job.args.front();
+        if (commands.count(name) == 0 || name == "b" || name == "serve") {
+            errormsg() << "Unknown command on line " << job.line_number <<
+                ": " << name << std::endl;
+            return 1;
+        }
+    }
+
+    // Run jobs, textures of the jobs get queued in the same pool
+
+    std::vector<int> statuses(jobs.size());
+    WorkerPool pool(get_job_count(args::get(jobs_arg)));
+    set_shared_pool(&pool);
+    try {
+        parallel_for(jobs.size(), 0, [&](size_t job_i) {
+            const BatchJob& job = jobs[job_i];
+            const commandtype& command = commands.at(job.args.front());
+            statuses[job_i] = command(job_progname, job.args.begin() + 1, job.args.end());
+        });
+    } catch (const std::exception& e) {
+        set_shared_pool(nullptr);
+        errormsg() << "Batch failed: " << e.what() << std::endl;
+        return 1;
+    }
+    set_shared_pool(nullptr);
+
+    // Report failures in job file order
+
+    size_t failed_count = 0;
+    for (size_t job_i = 0; job_i < jobs.size(); job_i++) {
+        if (statuses[job_i] != 0) {
+            errormsg() << "Failed job on line " << jobs[job_i].line_number <<
+                ": " << jobs[job_i].line << std::endl;
+            failed_count++;
+        }
+    }
+
+    std::cout << "Ran " << jobs.size() << " jobs, " << failed_count << " failed" << std::endl;
+
+    return (failed_count > 0) ? 1 : 0;
+}
+
+std::vector<BatchJob> read_jobs(std::istream& stream)
+{
+    std::vector<BatchJob> jobs;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(stream, line)) {
+        line_number++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        BatchJob job;
+        job.line_number = line_number;
+        job.line = line;
+        job.args = split_args(line);
+        if (job.args.empty() || job.args.front()[0] == '#') {
+            continue;
+        }
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
+
+std::vector<std::string> split_args(const std::string& line)
+{
+    std::vector<std::string> args;
+    std::string current;
+    bool in_arg = false;
+    bool in_quotes = false;
+
+    for (char c : line) {
+        if (c == '"') {
+            in_quotes = !in_quotes;
+            in_arg = true;
+        } else if ((c == ' ' || c == '\t') && !in_quotes) {
+            if (in_arg) {
+                args.push_back(current);
+                current.clear();
+                in_arg = false;
+            }
+        } else {
+            current += c;
+            in_arg = true;
+        }
+    }
+    if (in_arg) {
+        args.push_back(current);
+    }
+
+    return args;
+}
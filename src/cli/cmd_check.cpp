@@ -1,26 +1,35 @@
+#include <stdint.h>
 #include <stddef.h>
 #include <string>
 #include <vector>
 #include <iostream>
+#include <algorithm> // std::sort, std::max
 
 #include "args.hxx"
 
 #include "../headerfile.hpp"
+#include "../fileio.hpp"
+#include "../path.hpp"
 #include "../errors.hpp"
 #include "../common.hpp"
 #include "shared.hpp"
 
-bool check_textures(const PegHeader& header);
+bool check_textures(const PegHeader& header, uint64_t datafile_size);
+bool check_texture_data(const PegHeader& header, const MappedFile& datafile);
+bool texture_has_alpha(const PegEntry& entry, const char* texture_data);
 
 static const char* HELP_CHECK =
 R"(
 Checks a texture file for errors. No output means the file is probably ok.
+By default only the header and the size of the data file are checked.
 
 Usage: % [options] <header...>
 
 Options:
 
   -h, --help                        Display this help menu
+  -d, --deep                        Also read the texture data and check it
+                                    against the texture properties
   header                            Header files ending with cvbm_pc or cpeg_pc
 
 )";
@@ -33,6 +42,7 @@ int cmd_check(std::string progname,
     args::ArgumentParser parser("");
     args::HelpFlag help(parser, "help", "", {'h', "help"});
     args::PositionalList<std::string> header_arg(parser, "header", "");
+    args::Flag deep_arg(parser, "deep", "", {'d', "deep"});
 
     try {
         parser.ParseArgs(beginargs, endargs);
@@ -63,14 +73,37 @@ int cmd_check(std::string progname,
 
         try {
             PegHeader header = read_headerfile(header_filename);
-            read_datafile(data_filename, header);
 
-            bool failed = check_textures(header);
+            // Containers without textures don't need a data file
+            int64_t datafile_size = 0;
+            if (header.total_entries > 0) {
+                datafile_size = path::file_size(data_filename);
+                if (datafile_size < 0) {
+                    errormsg() << "Failed to open data file: " << data_filename << std::endl;
+                    std::cout << "Failed: " << header_filename << std::endl;
+                    continue;
+                }
+            }
+
+            bool failed = check_textures(header, static_cast<uint64_t>(datafile_size));
+            if (args::get(deep_arg) && header.total_entries > 0) {
+                MappedFile datafile;
+                try {
+                    datafile.open(data_filename);
+                } catch (const std::exception& e) {
+                    errormsg() << "Failed to open data file: " << e.what() << std::endl;
+                    std::cout << "Failed: " << header_filename << std::endl;
+                    continue;
+                }
+                failed |= check_texture_data(header, datafile);
+            }
             if (failed) {
                 std::cout << "Failed: " << header_filename << std::endl;
             }
         } catch (const exit_error& e) {
             return e.status;
+        } catch (const std::exception& e) {
+            return report_error(e);
         }
     }
 
@@ -85,30 +118,50 @@ int cmd_check(std::string progname,
         failed = true; \
     }
 
-bool check_textures(const PegHeader& header)
+// Checks that only need the header and the size of the data file
+
+bool check_textures(const PegHeader& header, uint64_t datafile_size)
 {
     bool failed = false;
 
     CHECK_FIELD(header.dir_block_size == header.size());
+    // Entries can share their data, only count the bytes they cover
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    for (const PegEntry& entry : header.entries) {
+        ranges.push_back(std::make_pair(entry.offset, entry.offset + entry.data_size));
+    }
+    std::sort(ranges.begin(), ranges.end());
     size_t textures_size_min = 0;
     size_t textures_size_max;
-    for (const PegEntry& entry : header.entries) {
-        textures_size_min += entry.data_size;
+    size_t range_count = 0;
+    int64_t covered_end = INT64_MIN;
+    for (const std::pair<int64_t, int64_t>& range : ranges) {
+        if (range.first >= covered_end) {
+            textures_size_min += static_cast<size_t>(range.second - range.first);
+            range_count++;
+        } else if (range.second > covered_end) {
+            textures_size_min += static_cast<size_t>(range.second - covered_end);
+        }
+        covered_end = std::max(covered_end, range.second);
     }
-    textures_size_max = textures_size_min + header.entries.size() * header.alignment;
+    textures_size_max = textures_size_min + range_count * header.alignment;
     CHECK_FIELD(header.data_block_size >= textures_size_min);
     CHECK_FIELD(header.data_block_size <= textures_size_max);
+    CHECK_FIELD(header.data_block_size <= datafile_size);
 
     //CHECK_FIELD(header.num_bitmaps > 0);
     CHECK_FIELD(header.num_bitmaps == header.entries.size());
     CHECK_FIELD(header.num_bitmaps == header.total_entries);
     //CHECK_FIELD(header.total_entries > 0)
     CHECK_FIELD(header.flags == 0);
-    CHECK_FIELD(header.alignment == 16);
+    // Repack can store a larger alignment than the usual 16
+    CHECK_FIELD(header.alignment >= MIN_DATA_ALIGNMENT && header.alignment <= MAX_DATA_ALIGNMENT);
+    CHECK_FIELD((header.alignment & (header.alignment - 1)) == 0);
 
     for (const PegEntry& entry : header.entries) {
         CHECK_FIELD(entry.offset < header.data_block_size);
         CHECK_FIELD(entry.offset + entry.data_size <= header.data_block_size);
+        CHECK_FIELD(entry.offset >= 0 && static_cast<uint64_t>(entry.offset) + entry.data_size <= datafile_size);
         CHECK_FIELD(entry.width > 0);
         CHECK_FIELD(entry.height > 0);
         CHECK_FIELD(TextureFormat::PC_DXT1 <= entry.bm_fmt);
@@ -122,13 +175,126 @@ bool check_textures(const PegHeader& header)
         CHECK_FIELD(entry.data_size >= 0);
 
         CHECK_FIELD(!entry.filename.empty());
-        CHECK_FIELD(!entry.data.empty());
+        CHECK_FIELD(entry.data_size > 0);
     }
 
     if (header.total_entries > 0) {
-        const PegEntry& last_entry = header.entries.back();
-        CHECK_FIELD(header.data_block_size <= last_entry.offset + last_entry.data_size + header.alignment);
+        int64_t data_end = covered_end;
+        CHECK_FIELD(header.data_block_size <= data_end + header.alignment);
+    }
+
+    return failed;
+}
+
+// Checks that need the texture data, entries outside of the data file are
+// skipped because check_textures already reports them
+
+bool check_texture_data(const PegHeader& header, const MappedFile& datafile)
+{
+    bool failed = false;
+
+    for (const PegEntry& entry : header.entries) {
+        if (entry.offset < 0 || static_cast<uint64_t>(entry.offset) + entry.data_size > datafile.size()) {
+            continue;
+        }
+        const char* texture_data = datafile.data() + entry.offset;
+
+        CHECK_FIELD(entry.data_size == entry.calc_data_size());
+        // Normal maps and masks can use the alpha channel without the flag
+        if (!(entry.flags & BM_F_ALPHA) && texture_has_alpha(entry, texture_data)) {
+            warnmsg() << entry.filename << " has alpha but no alpha flag" << std::endl;
+        }
     }
 
     return failed;
 }
+
+// Looks for pixels that aren't fully opaque
+
+bool texture_has_alpha(const PegEntry& entry, const char* texture_data)
+{
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(texture_data);
+    size_t size = entry.data_size;
+
+    switch (entry.bm_fmt) {
+    case TextureFormat::PC_DXT1:
+        // Index 3 is transparent if the first color is not the larger one
+        for (size_t pos = 0; pos + 8 <= size; pos += 8) {
+            uint16_t color0 = data[pos] | (data[pos + 1] << 8);
+            uint16_t color1 = data[pos + 2] | (data[pos + 3] << 8);
+            if (color0 > color1) {
+                continue;
+            }
+            for (size_t byte_i = 4; byte_i < 8; byte_i++) {
+                uint8_t indices = data[pos + byte_i];
+                for (int shift = 0; shift < 8; shift += 2) {
+                    if (((indices >> shift) & 0x3) == 3) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    case TextureFormat::PC_DXT3:
+        // Explicit 4 bit alpha in the first half of every block
+        for (size_t pos = 0; pos + 16 <= size; pos += 16) {
+            for (size_t byte_i = 0; byte_i < 8; byte_i++) {
+                if (data[pos + byte_i] != 0xFF) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    case TextureFormat::PC_DXT5:
+        // Interpolated alpha, check the palette value of every used index
+        for (size_t pos = 0; pos + 16 <= size; pos += 16) {
+            uint32_t alpha0 = data[pos];
+            uint32_t alpha1 = data[pos + 1];
+            uint32_t palette[8] = {alpha0, alpha1};
+            if (alpha0 > alpha1) {
+                for (uint32_t i = 1; i < 7; i++) {
+                    palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+                }
+            } else {
+                for (uint32_t i = 1; i < 5; i++) {
+                    palette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+                }
+                palette[6] = 0;
+                palette[7] = 255;
+            }
+            uint64_t indices = 0;
+            for (size_t byte_i = 0; byte_i < 6; byte_i++) {
+                indices |= static_cast<uint64_t>(data[pos + 2 + byte_i]) << (8 * byte_i);
+            }
+            for (int pixel = 0; pixel < 16; pixel++) {
+                if (palette[(indices >> (3 * pixel)) & 0x7] != 255) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    case TextureFormat::PC_1555:
+        for (size_t pos = 1; pos < size; pos += 2) {
+            if ((data[pos] & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    case TextureFormat::PC_4444:
+        for (size_t pos = 1; pos < size; pos += 2) {
+            if ((data[pos] & 0xF0) != 0xF0) {
+                return true;
+            }
+        }
+        return false;
+    case TextureFormat::PC_8888:
+        for (size_t pos = 3; pos < size; pos += 4) {
+            if (data[pos] != 0xFF) {
+                return true;
+            }
+        }
+        return false;
+    default:
+        return false;
+    }
+}
@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <unordered_set>
 
 #include "args.hxx"
 
@@ -15,7 +16,8 @@ void delete_textures(const std::vector<std::string>& texture_names, PegHeader& h
 
 static const char* HELP_DELETE =
 R"(
-Deletes textures from a container.
+Deletes textures from a container. If several textures have the same name,
+only the first one is deleted.
 
 Usage: % [options] <header> <textures...>
 
@@ -88,14 +90,17 @@ int cmd_delete(std::string progname,
 
     try {
         PegHeader header = read_headerfile(header_in_filename);
-        read_datafile(data_in_filename, header);
 
         delete_textures(texture_names, header);
 
-        write_datafile(data_out_filename, header);
-        write_headerfile(header_out_filename, header);
+        ContainerCommit commit(header_out_filename);
+        write_datafile(commit.add_file(data_out_filename), header, data_in_filename);
+        write_headerfile(commit.add_file(header_out_filename), header);
+        commit.commit();
     } catch (const exit_error& e) {
         return e.status;
+    } catch (const std::exception& e) {
+        return report_error(e);
     }
 
     return 0;
@@ -103,12 +108,20 @@ int cmd_delete(std::string progname,
 
 void delete_textures(const std::vector<std::string>& texture_names, PegHeader& header)
 {
+    // Names given more than once are only deleted and reported once
+    std::unordered_set<std::string> seen_names;
+    std::unordered_set<std::string> found_names;
     for (const std::string& name : texture_names) {
-        bool success = header.remove_entry(name);
-        if (success) {
+        if (!seen_names.insert(name).second) {
+            continue;
+        }
+        if (header.entry_index(name) != SIZE_MAX) {
+            found_names.insert(name);
             infomsg() << "Deleted " << name << std::endl;
         } else {
             warnmsg() << "Skipped " << name << ": Texture not found" << std::endl;
         }
     }
+
+    header.remove_entries(found_names);
 }
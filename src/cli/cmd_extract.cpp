@@ -2,25 +2,44 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <memory> // std::shared_ptr
 #include <fstream>
-#include <algorithm> // std::find
+#include <unordered_set>
+#include <stdexcept> // std::runtime_error
 
 #include "args.hxx"
 
 #include "../headerfile.hpp"
+#include "../fileio.hpp"
 #include "../ddsfile.hpp"
+#include "../texture.hpp"
+#include "../tgafile.hpp"
 #include "../path.hpp"
+#include "../stats.hpp"
 #include "../errors.hpp"
 #include "../common.hpp"
 #include "../gcc/abi_fix.hpp"
 #include "shared.hpp"
+#include "workers.hpp"
 
-void write_dds(const std::string& output_dir, const PegHeader& header,
-    const std::vector<std::string>& texture_names);
+enum class OutputFormat
+{
+    DDS,
+    RGBA,
+    TGA
+};
+
+void write_textures(const std::string& output_dir, const PegHeader& header,
+    MappedFile* datafile, const std::vector<std::string>& texture_names,
+    OutputFormat format, unsigned jobs);
+void write_dds_file(const std::string& output_dir, const PegEntry& entry);
+void write_decoded_file(const std::string& output_dir, const PegEntry& entry,
+    OutputFormat format);
 
 static const char* HELP_EXTRACT =
 R"(
-Extracts the textures in a container as DDS files.
+Extracts the textures in a container as DDS files, or decodes them to raw
+RGBA or TGA images.
 
 Usage: % [options] <header> [textures...]
 
@@ -28,6 +47,12 @@ Options:
 
   -h, --help                        Display this help menu
   -o [output], --output=[output]    Directory to write the files to
+  -j [jobs], --jobs=[jobs]          Number of textures to extract in
+                                    parallel, 0 for one per CPU (default 1)
+  -f [format], --format=[format]    Output format: dds, rgba or tga
+                                    (default dds). rgba writes every mip
+                                    level as 8 bit RGBA, largest first, tga
+                                    only the base level.
   header                            Header file ending with cvbm_pc or cpeg_pc
   textures                          Texture names if you only want to extract
                                     certain textures
@@ -44,6 +69,8 @@ int cmd_extract(std::string progname,
     args::Positional<std::string> header_arg(parser, "header", "");
     args::PositionalList<std::string> textures_arg(parser, "textures", "");
     args::ValueFlag<std::string> output_arg(parser, "output", "", {'o', "output"});
+    args::ValueFlag<unsigned> jobs_arg(parser, "jobs", "", {'j', "jobs"}, 1);
+    args::ValueFlag<std::string> format_arg(parser, "format", "", {'f', "format"}, "dds");
 
     try {
         parser.ParseArgs(beginargs, endargs);
@@ -73,83 +100,216 @@ int cmd_extract(std::string progname,
 
     std::string output_dir = args::get(output_arg);
     std::vector<std::string> texture_names = args::get(textures_arg);
+    unsigned jobs = args::get(jobs_arg);
+
+    OutputFormat format;
+    std::string format_name = args::get(format_arg);
+    if (format_name == "dds") {
+        format = OutputFormat::DDS;
+    } else if (format_name == "rgba") {
+        format = OutputFormat::RGBA;
+    } else if (format_name == "tga") {
+        format = OutputFormat::TGA;
+    } else {
+        errormsg() << "Unknown output format: " << format_name << std::endl;
+        return 1;
+    }
 
     try {
         PegHeader header = read_headerfile(header_filename);
-        read_datafile(data_filename, header);
+        std::shared_ptr<MappedFile> datafile = map_datafile(data_filename, header);
 
-        write_dds(output_dir, header, texture_names);
+        write_textures(output_dir, header, datafile.get(), texture_names, format, jobs);
     } catch (const exit_error& e) {
         return e.status;
+    } catch (const std::exception& e) {
+        return report_error(e);
     }
 
     return 0;
 }
 
-void write_dds(const std::string& output_dir, const PegHeader& header,
-    const std::vector<std::string>& texture_names)
+void write_textures(const std::string& output_dir, const PegHeader& header,
+    MappedFile* datafile, const std::vector<std::string>& texture_names,
+    OutputFormat format, unsigned jobs)
 {
+    ScopedTimer timer(StatPhase::WriteTextures);
+
     if (header.total_entries == 0) {
         warnmsg() << "File contains no texture entries" << std::endl;
     }
 
-    for (const PegEntry& entry : header.entries) {
-
-        // Filter entries, skip if names are empty
+    // Filter entries, skip if names are empty
 
-        if (!texture_names.empty()) {
-            auto found = std::find(texture_names.begin(), texture_names.end(), entry.filename);
-            if (found == texture_names.end()) {
+    std::unordered_set<std::string> name_filter(texture_names.begin(), texture_names.end());
+    std::vector<size_t> selected;
+    for (size_t entry_i = 0; entry_i < header.entries.size(); entry_i++) {
+        if (!name_filter.empty()) {
+            if (name_filter.count(header.entries[entry_i].filename) == 0) {
                 continue;
             }
         }
+        selected.push_back(entry_i);
+    }
+
+    // Entries with the same name write the same file. Only the last one is
+    // kept, which is the file a sequential extract leaves behind, so workers
+    // never write one file at the same time.
+
+    std::unordered_set<std::string> written_names;
+    size_t kept = selected.size();
+    for (size_t selected_i = selected.size(); selected_i-- > 0;) {
+        const std::string& name = header.entries[selected[selected_i]].filename;
+        if (written_names.insert(name).second) {
+            selected[--kept] = selected[selected_i];
+        } else {
+            warnmsg() << "Skipped duplicate entry " << selected[selected_i] << ": " << name << std::endl;
+        }
+    }
+    selected.erase(selected.begin(), selected.begin() + kept);
 
-        infomsg() << "Extracting " << entry.filename << std::endl;
+    // Extract in file order, so the data is read front to back. Gaps in the
+    // data file get the data after them loaded ahead of time.
 
-        // Make dds filename
+    std::vector<size_t> order = selected;
+    sort_by_offset(header, order);
+    std::vector<DataRange> ranges = merge_data_ranges(header, order);
+    std::vector<size_t> range_indices(order.size());
+    for (size_t range_i = 0; range_i < ranges.size(); range_i++) {
+        for (size_t order_i = ranges[range_i].first; order_i < ranges[range_i].last; order_i++) {
+            range_indices[order_i] = range_i;
+        }
+    }
 
-        std::string dds_filepath = entry.filename + ".dds";
-        if (!output_dir.empty()) {
-            // Use a custom output directory
-            dds_filepath = path::join(output_dir, dds_filepath);
+    std::unique_ptr<Prefetcher> prefetcher;
+    if (datafile != nullptr) {
+        if (is_fragmented(ranges)) {
+            prefetcher.reset(new Prefetcher(get_prefetch_ranges(ranges), PREFETCH_WINDOW,
+                [datafile](uint64_t offset, uint64_t size) {
+                    datafile->will_need(offset, size);
+                }));
+        } else {
+            datafile->advise_sequential();
         }
+    }
 
-        // Convert to DDS header
+    // Extract in parallel, errors are reported in entry order afterwards
 
-        DDSHeader dds_header;
+    std::vector<std::string> errors(header.entries.size());
+    parallel_for(order.size(), jobs, [&](size_t order_i) {
+        if (prefetcher) {
+            prefetcher->advance(range_indices[order_i]);
+        }
+        const PegEntry& entry = header.entries[order[order_i]];
         try {
-            dds_header = entry.to_dds();
+            if (format == OutputFormat::DDS) {
+                write_dds_file(output_dir, entry);
+            } else {
+                write_decoded_file(output_dir, entry, format);
+            }
         } catch (const std::exception& e) {
-            errormsg() << "Failed to convert entry: " << e.what() << std::endl;
-            throw exit_error(1);
+            errors[order[order_i]] = e.what();
         }
+    });
 
-        // Open DDS file
-
-        std::ofstream ddsfile;
-        set_ios_exceptions(ddsfile);
-        try {
-            GCC_ABI_WORKAROUND_START
-            ddsfile.open(dds_filepath, OPENMODE_WRITE);
-            GCC_ABI_WORKAROUND_END
-        } catch (std::ios::failure) {
-            errormsg() << "Failed to open DDS file for writing: " << dds_filepath << std::endl;
-            throw exit_error(1);
+    bool failed = false;
+    for (size_t entry_i : selected) {
+        infomsg() << "Extracting " << header.entries[entry_i].filename << std::endl;
+        if (!errors[entry_i].empty()) {
+            errormsg() << errors[entry_i] << std::endl;
+            failed = true;
         }
+    }
+    if (failed) {
+        throw exit_error(1);
+    }
+}
 
-        // Write DDS file
+void write_dds_file(const std::string& output_dir, const PegEntry& entry)
+{
+    // Make dds filename
 
-        try {
-            GCC_ABI_WORKAROUND_START
-            dds_header.write(ddsfile);
-            ddsfile.write(entry.data.data(), entry.data.size());
-            GCC_ABI_WORKAROUND_END
-        } catch (std::ios::failure) {
-            errormsg() << "Failed to write DDS file: " << get_stream_error(ddsfile) << std::endl;
-            throw exit_error(1);
-        } catch (const std::exception& e) {
-            errormsg() << "Failed to write DDS file: " << e.what() << std::endl;
-            throw exit_error(1);
+    std::string dds_filepath = entry.filename + ".dds";
+    if (!output_dir.empty()) {
+        // Use a custom output directory
+        dds_filepath = path::join(output_dir, dds_filepath);
+    }
+
+    // Convert to DDS header
+
+    DDSHeader dds_header;
+    try {
+        dds_header = entry.to_dds();
+    } catch (const std::exception& e) {
+        throw std::runtime_error(std::string("Failed to convert entry: ") + e.what());
+    }
+
+    // Open DDS file
+
+    std::ofstream ddsfile;
+    set_ios_exceptions(ddsfile);
+    try {
+        GCC_ABI_WORKAROUND_START
+        ddsfile.open(dds_filepath, OPENMODE_WRITE);
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw std::runtime_error("Failed to open DDS file for writing: " + dds_filepath);
+    }
+
+    // Write DDS file
+
+    try {
+        GCC_ABI_WORKAROUND_START
+        dds_header.write(ddsfile);
+        ddsfile.write(entry.texture_data(), entry.data_size);
+        add_counter(StatCounter::BytesWritten, static_cast<uint64_t>(ddsfile.tellp()));
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw std::runtime_error(std::string("Failed to write DDS file: ") + get_stream_error(ddsfile));
+    } catch (const std::exception& e) {
+        throw std::runtime_error(std::string("Failed to write DDS file: ") + e.what());
+    }
+}
+
+void write_decoded_file(const std::string& output_dir, const PegEntry& entry,
+    OutputFormat format)
+{
+    // Texture names usually end with .tga already, don't repeat it
+
+    std::string extension = (format == OutputFormat::TGA) ? "tga" : "rgba";
+    std::string filepath = entry.filename;
+    if (path::extension(filepath) != extension) {
+        filepath += "." + extension;
+    }
+    if (!output_dir.empty()) {
+        filepath = path::join(output_dir, filepath);
+    }
+
+    std::vector<Image> levels = decode_texture(entry);
+
+    std::ofstream outfile;
+    set_ios_exceptions(outfile);
+    try {
+        GCC_ABI_WORKAROUND_START
+        outfile.open(filepath, OPENMODE_WRITE);
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw std::runtime_error("Failed to open image file for writing: " + filepath);
+    }
+
+    try {
+        GCC_ABI_WORKAROUND_START
+        if (format == OutputFormat::TGA) {
+            write_tga(outfile, levels[0]);
+        } else {
+            for (const Image& level : levels) {
+                outfile.write(reinterpret_cast<const char*>(level.pixels.data()),
+                    level.pixels.size());
+            }
         }
+        add_counter(StatCounter::BytesWritten, static_cast<uint64_t>(outfile.tellp()));
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw std::runtime_error(std::string("Failed to write image file: ") + get_stream_error(outfile));
     }
 }
@@ -0,0 +1,324 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm> // std::min, std::max, std::transform
+#include <stdio.h> // snprintf
+#include <string.h> // memcpy
+#include <ctype.h> // toupper
+
+#include "args.hxx"
+
+#include "../headerfile.hpp"
+#include "../ddsfile.hpp"
+#include "../mipmap.hpp"
+#include "../errors.hpp"
+#include "../common.hpp"
+#include "shared.hpp"
+#include "workers.hpp"
+
+// Data of several entries is generated in parallel, up to this many bytes
+const uint64_t BATCH_SIZE = 256 * 1024 * 1024;
+
+bool parse_formats(const std::string& names, std::vector<TextureFormat>& formats);
+
+static const char* HELP_GENERATE =
+R"(
+Generates a container with random textures for testing. The same options
+and seed always give the same container. Texture data is written as it is
+generated, so the data file can be much larger than the available memory.
+The format limits the data file to 4 GB.
+
+Usage: % [options] <header>
+
+Options:
+
+  -h, --help                        Display this help menu
+  -n [count], --entries=[count]     Number of textures (default 100)
+  -f [formats], --formats=[formats] Comma separated formats to pick from
+                                    (default DXT1,DXT5,A8R8G8B8)
+  --min-size=[size]                 Smallest width and height (default 64)
+  --max-size=[size]                 Largest width and height, at most 65535
+                                    (default 1024)
+  -m [mode], --mips=[mode]          full, none or random number of mip
+                                    levels (default full)
+  --nonpow2                         Also use sizes that aren't powers of two
+  -s [seed], --seed=[seed]          Seed for sizes, formats and data
+                                    (default 1)
+  -j [jobs], --jobs=[jobs]          Number of threads for generating data,
+                                    0 for one per CPU (default 1)
+  header                            Header file ending with cvbm_pc or cpeg_pc
+
+)";
+
+int cmd_generate(std::string progname,
+    std::vector<std::string>::const_iterator beginargs,
+    std::vector<std::string>::const_iterator endargs)
+{
+    progname += " g";
+    args::ArgumentParser parser("");
+    args::HelpFlag help(parser, "help", "", {'h', "help"});
+    args::Positional<std::string> header_arg(parser, "header", "");
+    args::ValueFlag<size_t> entries_arg(parser, "count", "", {'n', "entries"}, 100);
+    args::ValueFlag<std::string> formats_arg(parser, "formats", "", {'f', "formats"},
+        "DXT1,DXT5,A8R8G8B8");
+    args::ValueFlag<uint32_t> min_size_arg(parser, "size", "", {"min-size"}, 64);
+    args::ValueFlag<uint32_t> max_size_arg(parser, "size", "", {"max-size"}, 1024);
+    args::ValueFlag<std::string> mips_arg(parser, "mode", "", {'m', "mips"}, "full");
+    args::Flag nonpow2_arg(parser, "nonpow2", "", {"nonpow2"});
+    args::ValueFlag<uint64_t> seed_arg(parser, "seed", "", {'s', "seed"}, 1);
+    args::ValueFlag<unsigned> jobs_arg(parser, "jobs", "", {'j', "jobs"}, 1);
+
+    try {
+        parser.ParseArgs(beginargs, endargs);
+    } catch (args::Help) {
+        std::cerr << help_format(HELP_GENERATE, progname);
+        return 0;
+    } catch (const args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << help_format(HELP_GENERATE, progname);
+        return 1;
+    } catch (const args::ValidationError& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!header_arg) {
+        std::cerr << help_format(HELP_GENERATE, progname);
+        return 1;
+    }
+
+    GenerateOptions options;
+    options.entries = args::get(entries_arg);
+    options.min_size = args::get(min_size_arg);
+    options.max_size = args::get(max_size_arg);
+    options.nonpow2 = args::get(nonpow2_arg);
+    options.seed = args::get(seed_arg);
+    options.jobs = args::get(jobs_arg);
+
+    // The entry count fields of the header are 16 bit, so are the sizes
+    if (options.entries == 0 || options.entries > UINT16_MAX) {
+        errormsg() << "Entry count must be between 1 and " << UINT16_MAX << std::endl;
+        return 1;
+    }
+    if (options.min_size == 0 || options.min_size > options.max_size ||
+            options.max_size > UINT16_MAX) {
+        errormsg() << "Sizes must be between 1 and " << UINT16_MAX <<
+            " and the minimum can't be above the maximum" << std::endl;
+        return 1;
+    }
+    if (!parse_formats(args::get(formats_arg), options.formats)) {
+        return 1;
+    }
+
+    std::string mips_name = args::get(mips_arg);
+    if (mips_name == "full") {
+        options.mips = MipMode::Full;
+    } else if (mips_name == "none") {
+        options.mips = MipMode::None;
+    } else if (mips_name == "random") {
+        options.mips = MipMode::Random;
+    } else {
+        errormsg() << "Unknown mip mode: " << mips_name << std::endl;
+        return 1;
+    }
+
+    std::string header_filename = args::get(header_arg);
+    std::string data_filename = get_data_filename(header_filename);
+    if (data_filename.empty()) {
+        errormsg() << "Invalid file extension" << std::endl;
+        return 1;
+    }
+
+    PegHeader header = generate_entries(options);
+
+    // Check the total size before writing anything
+
+    uint64_t data_end = 0;
+    for (const PegEntry& entry : header.entries) {
+        data_end = (data_end + header.alignment - 1) / header.alignment * header.alignment;
+        data_end += entry.data_size;
+    }
+    if (data_end > UINT32_MAX) {
+        errormsg() << "The data file would be " << data_end <<
+            " bytes, the format can only store up to 4 GB" << std::endl;
+        return 1;
+    }
+    infomsg() << "Generating " << header.entries.size() << " textures with " <<
+        data_end << " bytes of data" << std::endl;
+
+    // Generate a batch of entries in parallel, then write them in order
+
+    try {
+        ContainerCommit commit(header_filename);
+        DataFileWriter datafile(commit.add_file(data_filename), header.alignment);
+        std::vector<std::vector<char>> batch;
+        size_t batch_start = 0;
+        while (batch_start < header.entries.size()) {
+            size_t batch_end = batch_start;
+            uint64_t batch_size = 0;
+            while (batch_end < header.entries.size() && (batch_end == batch_start ||
+                    batch_size + header.entries[batch_end].data_size <= BATCH_SIZE)) {
+                batch_size += header.entries[batch_end].data_size;
+                batch_end++;
+            }
+
+            batch.resize(batch_end - batch_start);
+            parallel_for(batch.size(), options.jobs, [&](size_t batch_i) {
+                size_t entry_i = batch_start + batch_i;
+                batch[batch_i].resize(header.entries[entry_i].data_size);
+                generate_data(options.seed, entry_i, batch[batch_i]);
+            });
+
+            for (size_t batch_i = 0; batch_i < batch.size(); batch_i++) {
+                PegEntry& entry = header.entries[batch_start + batch_i];
+                entry.offset = datafile.write(batch[batch_i].data(), batch[batch_i].size());
+            }
+            batch_start = batch_end;
+        }
+
+        header.data_block_size = static_cast<uint32_t>(datafile.size());
+        datafile.finish();
+        write_headerfile(commit.add_file(header_filename), header);
+        commit.commit();
+    } catch (const exit_error& e) {
+        return e.status;
+    } catch (const std::exception& e) {
+        return report_error(e);
+    }
+
+    return 0;
+}
+
+bool parse_formats(const std::string& names, std::vector<TextureFormat>& formats)
+{
+    size_t start = 0;
+    while (start <= names.size()) {
+        size_t end = std::min(names.find(',', start), names.size());
+        std::string name = names.substr(start, end - start);
+        std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+
+        bool found = false;
+        for (int fmt_i = static_cast<int>(TextureFormat::PC_DXT1);
+                fmt_i <= static_cast<int>(TextureFormat::PC_A8); fmt_i++) {
+            TextureFormat fmt = static_cast<TextureFormat>(fmt_i);
+            std::string fmt_name = get_format_name(fmt);
+            std::transform(fmt_name.begin(), fmt_name.end(), fmt_name.begin(), ::toupper);
+            if (name == fmt_name) {
+                formats.push_back(fmt);
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            errormsg() << "Unknown format: " << name << std::endl;
+            return false;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+// splitmix64, small and good enough for test data
+static uint64_t next_random(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint32_t random_range(uint64_t& state, uint32_t min, uint32_t max)
+{
+    return min + static_cast<uint32_t>(next_random(state) % (static_cast<uint64_t>(max) - min + 1));
+}
+
+static uint32_t random_size(uint64_t& state, const GenerateOptions& options)
+{
+    if (options.nonpow2) {
+        return random_range(state, options.min_size, options.max_size);
+    }
+
+    // Powers of two between the limits, or the closest one below max
+    uint32_t min_shift = 0;
+    while ((1u << min_shift) < options.min_size) {
+        min_shift++;
+    }
+    uint32_t max_shift = 0;
+    while ((2u << max_shift) <= options.max_size) {
+        max_shift++;
+    }
+    if (min_shift > max_shift) {
+        return 1u << max_shift;
+    }
+    return 1u << random_range(state, min_shift, max_shift);
+}
+
+// Picks sizes, formats and mip levels. The data is generated separately for
+// every entry, so it can be made in any order.
+
+PegHeader generate_entries(const GenerateOptions& options)
+{
+    uint64_t state = options.seed;
+    PegHeader header;
+    for (size_t entry_i = 0; entry_i < options.entries; entry_i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "gen_%05u.tga", static_cast<unsigned>(entry_i));
+
+        PegEntry entry;
+        entry.filename = name;
+        entry.bm_fmt = options.formats[next_random(state) % options.formats.size()];
+        uint32_t width = random_size(state, options);
+        uint32_t height = random_size(state, options);
+        uint32_t mip_count = calc_mip_count(width, height);
+        uint32_t mip_levels = 1;
+        if (options.mips == MipMode::Full) {
+            mip_levels = mip_count;
+        } else if (options.mips == MipMode::Random) {
+            mip_levels = random_range(state, 1, mip_count);
+        }
+
+        entry.width = static_cast<uint16_t>(width);
+        entry.height = static_cast<uint16_t>(height);
+        entry.mip_levels = static_cast<uint8_t>(mip_levels);
+
+        // data_size is 32 bit, halve the larger side until the texture fits
+        while (entry.calc_data_size() > UINT32_MAX) {
+            if (width >= height) {
+                width = std::max(1u, width / 2);
+            } else {
+                height = std::max(1u, height / 2);
+            }
+            entry.width = static_cast<uint16_t>(width);
+            entry.height = static_cast<uint16_t>(height);
+            entry.mip_levels = static_cast<uint8_t>(std::min(mip_levels, calc_mip_count(width, height)));
+        }
+        entry.data_size = static_cast<uint32_t>(entry.calc_data_size());
+        if ((width & (width - 1)) != 0 || (height & (height - 1)) != 0) {
+            entry.flags |= BM_F_NONPOW2;
+        }
+        if (entry.bm_fmt != TextureFormat::PC_565 && entry.bm_fmt != TextureFormat::PC_888 &&
+                entry.bm_fmt != TextureFormat::PC_16_DUDV &&
+                entry.bm_fmt != TextureFormat::PC_16_DOT3_COMPRESSED) {
+            entry.flags |= BM_F_ALPHA;
+        }
+        header.add_entry(std::move(entry));
+    }
+    return header;
+}
+
+void generate_data(uint64_t seed, size_t entry_i, std::vector<char>& data)
+{
+    uint64_t state = seed ^ (static_cast<uint64_t>(entry_i + 1) * 0xD1B54A32D192ED03ULL);
+    size_t pos = 0;
+    for (; pos + 8 <= data.size(); pos += 8) {
+        uint64_t value = next_random(state);
+        memcpy(data.data() + pos, &value, 8);
+    }
+    uint64_t value = next_random(state);
+    for (; pos < data.size(); pos++) {
+        data[pos] = static_cast<char>(value);
+        value >>= 8;
+    }
+}
@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <memory> // std::shared_ptr
+#include <algorithm> // std::sort
+#include <set>
+#include <string.h> // memcmp
+
+#include "args.hxx"
+
+#include "../headerfile.hpp"
+#include "../fileio.hpp"
+#include "../hash.hpp"
+#include "../errors.hpp"
+#include "shared.hpp"
+#include "workers.hpp"
+
+struct HashedTexture
+{
+    size_t file_i;
+    size_t entry_i;
+    uint64_t hash;
+};
+
+struct Container
+{
+    std::string filename;
+    PegHeader header;
+    std::shared_ptr<MappedFile> datafile;
+};
+
+std::vector<std::vector<HashedTexture>> find_duplicates(
+    const std::vector<Container>& containers, std::vector<HashedTexture>& textures);
+
+static const char* HELP_HASH =
+R"(
+Finds textures with identical data, inside one container or across several.
+Every group of identical textures is printed with the containers they are
+in. Containers can share the data of identical textures with "a --dedup".
+
+Usage: % [options] <header...>
+
+Options:
+
+  -h, --help                        Display this help menu
+  -j [jobs], --jobs=[jobs]          Number of threads for hashing, 0 for
+                                    one per CPU (default 1)
+  -l, --list                        Print the hash of every texture
+  header                            Header files ending with cvbm_pc or cpeg_pc
+
+)";
+
+int cmd_hash(std::string progname,
+    std::vector<std::string>::const_iterator beginargs,
+    std::vector<std::string>::const_iterator endargs)
+{
+    progname += " h";
+    args::ArgumentParser parser("");
+    args::HelpFlag help(parser, "help", "", {'h', "help"});
+    args::PositionalList<std::string> header_arg(parser, "header", "");
+    args::ValueFlag<unsigned> jobs_arg(parser, "jobs", "", {'j', "jobs"}, 1);
+    args::Flag list_arg(parser, "list", "", {'l', "list"});
+
+    try {
+        parser.ParseArgs(beginargs, endargs);
+    } catch (args::Help) {
+        std::cerr << help_format(HELP_HASH, progname);
+        return 0;
+    } catch (const args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << help_format(HELP_HASH, progname);
+        return 1;
+    } catch (const args::ValidationError& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!header_arg) {
+        std::cerr << help_format(HELP_HASH, progname);
+        return 1;
+    }
+
+    // Map all containers
+
+    std::vector<Container> containers;
+    for (const std::string& header_filename : args::get(header_arg)) {
+        std::string data_filename = get_data_filename(header_filename);
+        if (data_filename.empty()) {
+            errormsg() << "Invalid file extension: " << header_filename << std::endl;
+            return 1;
+        }
+
+        Container container;
+        container.filename = header_filename;
+        try {
+            container.header = read_headerfile(header_filename);
+            container.datafile = map_datafile(data_filename, container.header);
+        } catch (const exit_error& e) {
+            return e.status;
+        } catch (const std::exception& e) {
+            return report_error(e);
+        }
+        containers.push_back(std::move(container));
+    }
+
+    // Hash every texture
+
+    std::vector<HashedTexture> textures;
+    for (size_t file_i = 0; file_i < containers.size(); file_i++) {
+        for (size_t entry_i = 0; entry_i < containers[file_i].header.entries.size(); entry_i++) {
+            textures.push_back({file_i, entry_i, 0});
+        }
+    }
+
+    parallel_for(textures.size(), args::get(jobs_arg), [&](size_t texture_i) {
+        HashedTexture& texture = textures[texture_i];
+        const PegEntry& entry = containers[texture.file_i].header.entries[texture.entry_i];
+        texture.hash = hash_data(entry.texture_data(), entry.data_size);
+    });
+
+    if (args::get(list_arg)) {
+        for (const HashedTexture& texture : textures) {
+            const PegEntry& entry = containers[texture.file_i].header.entries[texture.entry_i];
+            std::cout << std::hex << std::setfill('0') << std::setw(16) << texture.hash <<
+                std::dec << "  " << containers[texture.file_i].filename << ": " <<
+                entry.filename << std::endl;
+        }
+    }
+
+    // Print groups. Only copies at different offsets of the same container
+    // can be saved, copies in other containers have to stay.
+
+    std::vector<std::vector<HashedTexture>> groups = find_duplicates(containers, textures);
+    size_t duplicate_count = 0;
+    uint64_t saved_size = 0;
+    for (const std::vector<HashedTexture>& group : groups) {
+        const PegEntry& first = containers[group[0].file_i].header.entries[group[0].entry_i];
+        std::cout << "Identical textures (" << first.data_size << " bytes):" << std::endl;
+
+        std::set<std::pair<size_t, int64_t>> slots;
+        for (const HashedTexture& texture : group) {
+            const PegEntry& entry = containers[texture.file_i].header.entries[texture.entry_i];
+            std::cout << "  " << containers[texture.file_i].filename << ": " <<
+                entry.filename << std::endl;
+            slots.insert(std::make_pair(texture.file_i, entry.offset));
+        }
+
+        std::set<size_t> files;
+        for (const HashedTexture& texture : group) {
+            files.insert(texture.file_i);
+        }
+        duplicate_count += group.size() - 1;
+        saved_size += static_cast<uint64_t>(slots.size() - files.size()) * first.data_size;
+    }
+
+    std::cout << "Found " << duplicate_count << " duplicate textures in " <<
+        groups.size() << " groups" << std::endl;
+    std::cout << "Sharing data inside the containers saves " << saved_size << " bytes" << std::endl;
+
+    return 0;
+}
+
+// Groups textures with the same size and hash, and compares their data so a
+// hash collision can't group different textures. Groups are ordered by
+// their first texture.
+
+std::vector<std::vector<HashedTexture>> find_duplicates(
+    const std::vector<Container>& containers, std::vector<HashedTexture>& textures)
+{
+    auto get_entry = [&](const HashedTexture& texture) -> const PegEntry& {
+        return containers[texture.file_i].header.entries[texture.entry_i];
+    };
+
+    std::vector<HashedTexture> sorted = textures;
+    std::sort(sorted.begin(), sorted.end(), [&](const HashedTexture& a, const HashedTexture& b) {
+        if (a.hash != b.hash) {
+            return a.hash < b.hash;
+        }
+        if (get_entry(a).data_size != get_entry(b).data_size) {
+            return get_entry(a).data_size < get_entry(b).data_size;
+        }
+        if (a.file_i != b.file_i) {
+            return a.file_i < b.file_i;
+        }
+        return a.entry_i < b.entry_i;
+    });
+
+    std::vector<std::vector<HashedTexture>> groups;
+    size_t run_start = 0;
+    while (run_start < sorted.size()) {
+        size_t run_end = run_start + 1;
+        while (run_end < sorted.size() && sorted[run_end].hash == sorted[run_start].hash &&
+                get_entry(sorted[run_end]).data_size == get_entry(sorted[run_start]).data_size) {
+            run_end++;
+        }
+
+        // Split the run by comparing against the first texture of each group
+        std::vector<std::vector<HashedTexture>> run_groups;
+        for (size_t texture_i = run_start; texture_i < run_end; texture_i++) {
+            const PegEntry& entry = get_entry(sorted[texture_i]);
+            bool found = false;
+            for (std::vector<HashedTexture>& group : run_groups) {
+                const PegEntry& first = get_entry(group[0]);
+                if (memcmp(first.texture_data(), entry.texture_data(), entry.data_size) == 0) {
+                    group.push_back(sorted[texture_i]);
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                run_groups.push_back({sorted[texture_i]});
+            }
+        }
+        for (std::vector<HashedTexture>& group : run_groups) {
+            if (group.size() > 1) {
+                groups.push_back(std::move(group));
+            }
+        }
+        run_start = run_end;
+    }
+
+    std::sort(groups.begin(), groups.end(),
+        [](const std::vector<HashedTexture>& a, const std::vector<HashedTexture>& b) {
+            if (a[0].file_i != b[0].file_i) {
+                return a[0].file_i < b[0].file_i;
+            }
+            return a[0].entry_i < b[0].entry_i;
+        });
+    return groups;
+}
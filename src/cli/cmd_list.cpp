@@ -61,6 +61,8 @@ int cmd_list(std::string progname,
         std::cout << list_header(header);
     } catch (const exit_error& e) {
         return e.status;
+    } catch (const std::exception& e) {
+        return report_error(e);
     }
 
     return 0;
@@ -116,14 +116,21 @@ int cmd_modify(std::string progname,
 
     try {
         PegHeader header = read_headerfile(header_in_filename);
-        read_datafile(data_in_filename, header);
 
         modify_texture(texture_name, header, new_name, flags);
 
-        write_datafile(data_out_filename, header);
-        write_headerfile(header_out_filename, header);
+        // Only the header changes, so the data file only has to be written
+        // when the container goes to a different location
+        ContainerCommit commit(header_out_filename);
+        if (data_out_filename != data_in_filename) {
+            write_datafile(commit.add_file(data_out_filename), header, data_in_filename);
+        }
+        write_headerfile(commit.add_file(header_out_filename), header);
+        commit.commit();
     } catch (const exit_error& e) {
         return e.status;
+    } catch (const std::exception& e) {
+        return report_error(e);
     }
 
     return 0;
@@ -140,7 +147,7 @@ void modify_texture(const std::string& texture_name, PegHeader& header,
 
     PegEntry& entry = header.entries.at(index);
     if (!new_name.empty()) {
-        entry.filename = new_name;
+        header.rename_entry(index, new_name);
     }
     if (flags != 0xFFFF) {
         entry.flags = flags;
@@ -0,0 +1,288 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <memory> // std::unique_ptr
+#include <unordered_map>
+#include <algorithm> // std::stable_sort
+
+#include "args.hxx"
+
+#include "../headerfile.hpp"
+#include "../fileio.hpp"
+#include "../path.hpp"
+#include "../stats.hpp"
+#include "../errors.hpp"
+#include "../common.hpp"
+#include "shared.hpp"
+
+std::vector<size_t> get_repack_order(const PegHeader& header, const std::string& order_name,
+    const std::string& trace_filename);
+uint64_t repack_datafile(const std::string& data_in_filename, const std::string& data_out_filename,
+    PegHeader& header, const std::vector<size_t>& order, uint16_t alignment, bool dry_run);
+
+static const char* HELP_REPACK =
+R"(
+Rewrites the data file of a container without unused space, with the
+texture data in a chosen order. Textures sharing their data keep sharing it.
+The header keeps its entry order, only the offsets change.
+
+Usage: % [options] <header>
+
+Options:
+
+  -h, --help                        Display this help menu
+  -o [output], --output=[output]    Directory to write the new container to
+  --order=[order]                   Order of the texture data: file (as it
+                                    is now), entry (as in the header),
+                                    name, size (largest first) or trace
+                                    (default file)
+  -t [file], --trace=[file]         Texture names in the order they get
+                                    used, one per line, for --order=trace.
+                                    Textures that aren't listed follow in
+                                    file order
+  -a [bytes], --alignment=[bytes]   Start every texture at a multiple of
+                                    this, for example 4096 for page aligned
+                                    textures. Power of two from 16 to 32768.
+                                    Stored in the header, so later updates
+                                    keep it (default alignment of the
+                                    container)
+  -n, --dry-run                     Only print how much space would be saved
+  header                            Header file ending with cvbm_pc or cpeg_pc
+
+)";
+
+int cmd_repack(std::string progname,
+    std::vector<std::string>::const_iterator beginargs,
+    std::vector<std::string>::const_iterator endargs)
+{
+    progname += " r";
+    args::ArgumentParser parser("");
+    args::HelpFlag help(parser, "help", "", {'h', "help"});
+    args::Positional<std::string> header_arg(parser, "header", "");
+    args::ValueFlag<std::string> output_arg(parser, "output", "", {'o', "output"});
+    args::ValueFlag<std::string> order_arg(parser, "order", "", {"order"}, "file");
+    args::ValueFlag<std::string> trace_arg(parser, "trace", "", {'t', "trace"});
+    args::ValueFlag<uint32_t> alignment_arg(parser, "alignment", "", {'a', "alignment"});
+    args::Flag dry_run_arg(parser, "dry-run", "", {'n', "dry-run"});
+
+    try {
+        parser.ParseArgs(beginargs, endargs);
+    } catch (args::Help) {
+        std::cerr << help_format(HELP_REPACK, progname);
+        return 0;
+    } catch (const args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << help_format(HELP_REPACK, progname);
+        return 1;
+    } catch (const args::ValidationError& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!header_arg) {
+        std::cerr << help_format(HELP_REPACK, progname);
+        return 1;
+    }
+
+    std::string header_in_filename = args::get(header_arg);
+    std::string data_in_filename = get_data_filename(header_in_filename);
+    if (data_in_filename.empty()) {
+        errormsg() << "Invalid file extension" << std::endl;
+        return 1;
+    }
+
+    std::string output_dir = args::get(output_arg);
+    std::string header_out_filename;
+    std::string data_out_filename;
+
+    if (!output_dir.empty()) {
+        header_out_filename = path::join(
+            output_dir, path::basename(header_in_filename));
+        data_out_filename = path::join(
+            output_dir, path::basename(data_in_filename));
+    } else {
+        header_out_filename = header_in_filename;
+        data_out_filename = data_in_filename;
+    }
+
+    std::string order_name = args::get(order_arg);
+    if (order_name == "trace" && !trace_arg) {
+        errormsg() << "--order=trace needs a trace file" << std::endl;
+        return 1;
+    }
+
+    try {
+        PegHeader header = read_headerfile(header_in_filename);
+
+        uint32_t alignment = alignment_arg ? args::get(alignment_arg) : header.alignment;
+        bool power_of_two = (alignment > 0) && ((alignment & (alignment - 1)) == 0);
+        if (!power_of_two || alignment > MAX_DATA_ALIGNMENT || alignment < MIN_DATA_ALIGNMENT) {
+            errormsg() << "Alignment has to be a power of two between " << MIN_DATA_ALIGNMENT <<
+                " and " << MAX_DATA_ALIGNMENT << std::endl;
+            return 1;
+        }
+
+        std::vector<size_t> order = get_repack_order(header, order_name, args::get(trace_arg));
+        uint64_t old_size = static_cast<uint64_t>(path::file_size(data_in_filename));
+        bool dry_run = args::get(dry_run_arg);
+
+        if (dry_run) {
+            uint64_t new_size = repack_datafile(data_in_filename, data_out_filename, header, order,
+                static_cast<uint16_t>(alignment), true);
+            std::cout << "Data file would go from " << old_size << " to " << new_size <<
+                " bytes" << std::endl;
+            return 0;
+        }
+
+        ContainerCommit commit(header_out_filename);
+        uint64_t new_size = repack_datafile(data_in_filename, commit.add_file(data_out_filename),
+            header, order, static_cast<uint16_t>(alignment), false);
+        write_headerfile(commit.add_file(header_out_filename), header);
+        commit.commit();
+
+        std::cout << "Data file went from " << old_size << " to " << new_size << " bytes";
+        if (new_size <= old_size) {
+            std::cout << ", " << old_size - new_size << " bytes saved" << std::endl;
+        } else {
+            std::cout << ", " << new_size - old_size << " bytes more for the alignment" << std::endl;
+        }
+    } catch (const exit_error& e) {
+        return e.status;
+    } catch (const std::exception& e) {
+        return report_error(e);
+    }
+
+    return 0;
+}
+
+// Entry indices in the order their data gets written
+std::vector<size_t> get_repack_order(const PegHeader& header, const std::string& order_name,
+    const std::string& trace_filename)
+{
+    std::vector<size_t> order(header.entries.size());
+    for (size_t entry_i = 0; entry_i < order.size(); entry_i++) {
+        order[entry_i] = entry_i;
+    }
+
+    if (order_name == "entry") {
+        return order;
+    } else if (order_name == "file") {
+        sort_by_offset(header, order);
+    } else if (order_name == "name") {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return header.entries[a].filename < header.entries[b].filename;
+        });
+    } else if (order_name == "size") {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return header.entries[a].data_size > header.entries[b].data_size;
+        });
+    } else if (order_name == "trace") {
+        std::ifstream tracefile(trace_filename);
+        if (!tracefile.is_open()) {
+            errormsg() << "Failed to open trace file: " << trace_filename << std::endl;
+            throw exit_error(1);
+        }
+
+        // Position of every texture in the trace, the first use counts
+        std::unordered_map<size_t, size_t> trace_positions;
+        std::string line;
+        while (std::getline(tracefile, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            size_t entry_i = header.entry_index(line);
+            if (entry_i != SIZE_MAX && trace_positions.count(entry_i) == 0) {
+                size_t position = trace_positions.size();
+                trace_positions[entry_i] = position;
+            }
+        }
+
+        sort_by_offset(header, order);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            auto a_found = trace_positions.find(a);
+            auto b_found = trace_positions.find(b);
+            if (b_found == trace_positions.end()) {
+                return a_found != trace_positions.end();
+            }
+            return a_found != trace_positions.end() && a_found->second < b_found->second;
+        });
+    } else {
+        errormsg() << "Unknown order: " << order_name << std::endl;
+        throw exit_error(1);
+    }
+    return order;
+}
+
+// Copies the texture data in the given order and updates the offsets. With
+// dry_run only the offsets are worked out. Returns the new data file size.
+uint64_t repack_datafile(const std::string& data_in_filename, const std::string& data_out_filename,
+    PegHeader& header, const std::vector<size_t>& order, uint16_t alignment, bool dry_run)
+{
+    ScopedTimer timer(StatPhase::WriteData);
+
+    RawFile source;
+    try {
+        source.open_read(data_in_filename);
+    } catch (const std::exception& e) {
+        errormsg() << "Failed to open data file: " << e.what() << std::endl;
+        throw exit_error(1);
+    }
+
+    uint64_t source_size = source.size();
+    for (const PegEntry& entry : header.entries) {
+        uint64_t data_end = static_cast<uint64_t>(entry.offset) + entry.data_size;
+        if (entry.offset < 0 || data_end > source_size) {
+            errormsg() << "Texture data of " << entry.filename <<
+                " is outside of the data file" << std::endl;
+            throw exit_error(1);
+        }
+    }
+
+    std::vector<int64_t> old_offsets(header.entries.size());
+    for (size_t entry_i = 0; entry_i < header.entries.size(); entry_i++) {
+        old_offsets[entry_i] = header.entries[entry_i].offset;
+    }
+
+    std::map<std::pair<int64_t, uint32_t>, int64_t> copied_slots; // Old slot to new offset
+    std::unique_ptr<DataFileWriter> datafile;
+    if (!dry_run) {
+        datafile.reset(new DataFileWriter(data_out_filename, alignment));
+    }
+
+    uint64_t data_end = 0;
+    try {
+        for (size_t entry_i : order) {
+            PegEntry& entry = header.entries[entry_i];
+            std::pair<int64_t, uint32_t> slot(old_offsets[entry_i], entry.data_size);
+            auto copied = copied_slots.find(slot);
+            if (copied != copied_slots.end()) {
+                entry.offset = copied->second;
+                continue;
+            }
+
+            if (dry_run) {
+                entry.offset = static_cast<int64_t>((data_end + alignment - 1) / alignment * alignment);
+            } else {
+                entry.offset = datafile->copy(source, old_offsets[entry_i], entry.data_size);
+            }
+            data_end = entry.offset + entry.data_size;
+            copied_slots[slot] = entry.offset;
+        }
+
+        header.data_block_size = static_cast<uint32_t>(data_end);
+        header.alignment = alignment;
+        source.close();
+        if (!dry_run) {
+            datafile->finish();
+        }
+    } catch (const std::exception& e) {
+        errormsg() << "Failed to write data file: " << e.what() << std::endl;
+        throw exit_error(1);
+    }
+
+    return data_end;
+}
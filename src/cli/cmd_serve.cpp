@@ -0,0 +1,258 @@
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h> // strerror, strncpy
+#endif
+
+#include "args.hxx"
+
+#include "../errors.hpp"
+#include "../common.hpp"
+#include "shared.hpp"
+
+static const char* HELP_SERVE =
+R"(
+Runs commands sent over a Unix domain socket, so programs that change
+containers many times don't start a new process every time. Headers and
+mapped data files of recently used containers stay in memory.
+
+Usage: % [options] <socket>
+
+Options:
+
+  -h, --help                        Display this help menu
+  -c [count], --cache=[count]       Number of header and data files to keep
+                                    in memory (default 16)
+  socket                            Path of the socket, an existing file is
+                                    replaced
+
+Every line sent to the socket is one command, written like a line of a job
+file for the b command, for example "x professorgenki.cpeg_pc -o extracted".
+The commands x, a, l, d, m and c can be used. Relative paths are relative to
+the working directory of the server. The reply is the output of the command
+followed by the line "exit <status>". Requests are run one at a time. The
+line "quit" stops the server.
+
+Not supported on Windows.
+
+)";
+
+#ifndef _WIN32
+
+// Commands that can be sent to the server
+static const std::unordered_set<std::string> SERVE_COMMANDS = {"x", "a", "l", "d", "m", "c"};
+
+// Sends the output of std::cout and std::cerr to a string until destroyed
+class OutputCapture
+{
+public:
+    OutputCapture()
+    {
+        m_cout = std::cout.rdbuf(m_output.rdbuf());
+        m_cerr = std::cerr.rdbuf(m_output.rdbuf());
+    }
+
+    ~OutputCapture()
+    {
+        std::cout.rdbuf(m_cout);
+        std::cerr.rdbuf(m_cerr);
+    }
+
+    std::string str() const
+    {
+        return m_output.str();
+    }
+
+private:
+    std::ostringstream m_output;
+    std::streambuf* m_cout;
+    std::streambuf* m_cerr;
+};
+
+static bool send_all(int fd, const std::string& data)
+{
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t result = send(fd, data.data() + sent, data.size() - sent, 0);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+// Runs one request line and returns the reply
+static std::string run_request(const std::string& progname, const std::string& line)
+{
+    std::vector<std::string> args = split_args(line);
+    if (args.empty()) {
+        return "exit 0\n";
+    }
+
+    const std::string& name = args.front();
+    if (SERVE_COMMANDS.count(name) == 0) {
+        return "[Error] Unknown command: " + name + "\nexit 1\n";
+    }
+
+    int status;
+    std::string output;
+    {
+        OutputCapture capture;
+        try {
+            status = get_commands().at(name)(progname, args.begin() + 1, args.end());
+        } catch (const std::exception& e) {
+            std::cerr << "[Error] " << e.what() << std::endl;
+            status = 1;
+        }
+        output = capture.str();
+    }
+    return output + "exit " + std::to_string(status) + "\n";
+}
+
+// Reads requests from one client until it disconnects. Returns false if the
+// client asked the server to stop.
+static bool serve_client(const std::string& progname, int client)
+{
+    std::string buffer;
+    char chunk[4096];
+    while (true) {
+        ssize_t received = recv(client, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return true;
+        }
+        buffer.append(chunk, static_cast<size_t>(received));
+
+        size_t line_end;
+        while ((line_end = buffer.find('\n')) != std::string::npos) {
+            std::string line = buffer.substr(0, line_end);
+            buffer.erase(0, line_end + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line == "quit") {
+                send_all(client, "exit 0\n");
+                return false;
+            }
+            if (!send_all(client, run_request(progname, line))) {
+                return true;
+            }
+        }
+    }
+}
+
+#endif
+
+int cmd_serve(std::string progname,
+    std::vector<std::string>::const_iterator beginargs,
+    std::vector<std::string>::const_iterator endargs)
+{
+    std::string request_progname = progname;
+    progname += " serve";
+    args::ArgumentParser parser("");
+    args::HelpFlag help(parser, "help", "", {'h', "help"});
+    args::Positional<std::string> socket_arg(parser, "socket", "");
+    args::ValueFlag<size_t> cache_arg(parser, "cache", "", {'c', "cache"}, 16);
+
+    try {
+        parser.ParseArgs(beginargs, endargs);
+    } catch (args::Help) {
+        std::cerr << help_format(HELP_SERVE, progname);
+        return 0;
+    } catch (const args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << help_format(HELP_SERVE, progname);
+        return 1;
+    } catch (const args::ValidationError& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!socket_arg) {
+        std::cerr << help_format(HELP_SERVE, progname);
+        return 1;
+    }
+
+#ifdef _WIN32
+    (void)request_progname;
+    errormsg() << "The serve command is not supported on Windows" << std::endl;
+    return 1;
+#else
+    std::string socket_filename = args::get(socket_arg);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_filename.size() >= sizeof(address.sun_path)) {
+        errormsg() << "Socket path is too long: " << socket_filename << std::endl;
+        return 1;
+    }
+    strncpy(address.sun_path, socket_filename.c_str(), sizeof(address.sun_path) - 1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        errormsg() << "Failed to create socket: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    // Only a socket left over from an earlier server is replaced, any other
+    // file at the path is most likely a mistyped argument
+    struct stat socket_stat;
+    if (lstat(socket_filename.c_str(), &socket_stat) == 0) {
+        if (!S_ISSOCK(socket_stat.st_mode)) {
+            errormsg() << "Not a socket, refusing to replace it: " << socket_filename << std::endl;
+            close(server);
+            return 1;
+        }
+        unlink(socket_filename.c_str());
+    }
+    if (bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(server, 16) != 0) {
+        errormsg() << "Failed to listen on " << socket_filename << ": " <<
+            strerror(errno) << std::endl;
+        close(server);
+        return 1;
+    }
+
+    // Clients that disconnect early shouldn't kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    enable_container_cache(args::get(cache_arg));
+    infomsg() << "Listening on " << socket_filename << std::endl;
+
+    bool running = true;
+    while (running) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            errormsg() << "Failed to accept connection: " << strerror(errno) << std::endl;
+            break;
+        }
+        running = serve_client(request_progname, client);
+        close(client);
+    }
+
+    enable_container_cache(0);
+    close(server);
+    unlink(socket_filename.c_str());
+    return running ? 1 : 0;
+#endif
+}
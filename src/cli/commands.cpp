@@ -0,0 +1,22 @@
+#include <string>
+#include <unordered_map>
+
+#include "shared.hpp"
+
+const std::unordered_map<std::string, commandtype>& get_commands()
+{
+    static const std::unordered_map<std::string, commandtype> cmdmap = {
+        {"x", cmd_extract},
+        {"a", cmd_add},
+        {"l", cmd_list},
+        {"d", cmd_delete},
+        {"m", cmd_modify},
+        {"c", cmd_check},
+        {"b", cmd_batch},
+        {"h", cmd_hash},
+        {"g", cmd_generate},
+        {"r", cmd_repack},
+        {"serve", cmd_serve}
+    };
+    return cmdmap;
+}
@@ -1,11 +1,16 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <fstream>
 #include <unordered_map>
+#include <stdlib.h> // getenv
 
 #include "args.hxx"
 
 #include "../path.hpp"
+#include "../stats.hpp"
+#include "../common.hpp"
+#include "../gcc/abi_fix.hpp"
 #include "shared.hpp"
 
 static const char* HELP_MAIN =
@@ -19,12 +24,26 @@ Usage: % [options] <command> [<args...>]
 Options:
 
   -h, --help                        Display this help menu
+  --journal                         Record changes to a container in a
+                                    journal file first, so an interrupted
+                                    write is finished on the next read
+  --write-buffer <size>             Size of the buffer for writing data files
+                                    in MB (default 4)
+  --direct-io                       Write data files without going through
+                                    the page cache, for very large files
+  --stats                           Print timings, I/O counters and peak
+                                    memory of the command to stderr
+  --stats-json <file>               Write the same as JSON to a file, "-"
+                                    writes to stdout
   command                           Command to execute
   args                              Arguments for the command
 
   "--" can be used to terminate flag options and force all following
   arguments to be treated as positional options
 
+  Setting the environment variable SRTEXTOOL_STATS to 1 works like --stats,
+  setting it to json prints the JSON to stderr instead.
+
 Commands:
 
   x: Extract textures
@@ -33,32 +52,81 @@ Commands:
   d: Delete textures
   m: Modify texture properties
   c: Check texture for errors
+  b: Run commands from a job file
+  h: Find identical textures
+  g: Generate a container with random textures
+  r: Repack the data file
+  serve: Run commands sent over a socket
 
 )";
 
+static void write_stats_json(const std::string& filename)
+{
+    if (filename == "-") {
+        print_stats_json(std::cout);
+        return;
+    }
+
+    std::ofstream statsfile;
+    set_ios_exceptions(statsfile);
+    try {
+        GCC_ABI_WORKAROUND_START
+        statsfile.open(filename, std::ios::out | std::ios::trunc);
+        print_stats_json(statsfile);
+        statsfile.close();
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        errormsg() << "Failed to write stats file: " << filename << std::endl;
+    }
+}
+
 int main(int argc, char** argv)
 {
-    std::unordered_map<std::string, commandtype> cmdmap = {
-        {"x", cmd_extract},
-        {"a", cmd_add},
-        {"l", cmd_list},
-        {"d", cmd_delete},
-        {"m", cmd_modify},
-        {"c", cmd_check}
-    };
+    const std::unordered_map<std::string, commandtype>& cmdmap = get_commands();
 
     std::string progname = path::basename(argv[0]);
     std::vector<std::string> cmdargs(argv + 1, argv + argc);
 
     args::ArgumentParser parser("");
     args::HelpFlag help(parser, "help", "", {'h', "help"});
+    args::Flag journal_arg(parser, "journal", "", {"journal"});
+    args::ValueFlag<size_t> write_buffer_arg(parser, "write-buffer", "", {"write-buffer"}, 4);
+    args::Flag direct_io_arg(parser, "direct-io", "", {"direct-io"});
+    args::Flag stats_arg(parser, "stats", "", {"stats"});
+    args::ValueFlag<std::string> stats_json_arg(parser, "stats-json", "", {"stats-json"});
     args::MapPositional<std::string, commandtype> command_arg(parser, "command", "", cmdmap);
     command_arg.KickOut(true);
 
     try {
         auto next = parser.ParseArgs(cmdargs);
         if (command_arg) {
-            return args::get(command_arg)(progname, next, std::end(cmdargs));
+            set_warning_handler([](const std::string& message) {
+                warnmsg() << message << std::endl;
+            });
+            set_container_journal(journal_arg);
+            set_write_buffer(args::get(write_buffer_arg) * 1024 * 1024, direct_io_arg);
+            const char* stats_env = getenv("SRTEXTOOL_STATS");
+            std::string stats_mode = (stats_env != nullptr) ? stats_env : "";
+            if (stats_mode == "0") {
+                stats_mode = "";
+            }
+            bool print_text = stats_arg || (!stats_mode.empty() && stats_mode != "json");
+            bool print_json = stats_json_arg || stats_mode == "json";
+            if (print_text || print_json) {
+                enable_stats();
+            }
+
+            int status = args::get(command_arg)(progname, next, std::end(cmdargs));
+
+            if (print_text) {
+                print_stats(std::cerr);
+            }
+            if (stats_json_arg) {
+                write_stats_json(args::get(stats_json_arg));
+            } else if (print_json) {
+                print_stats_json(std::cerr);
+            }
+            return status;
         } else {
             std::cout << help_format(HELP_MAIN, progname);
         }
@@ -1,38 +1,67 @@
 #pragma once
-#include <stddef.h>
 #include <string>
 #include <vector>
-#include <ios>
 #include <functional>
+#include <unordered_map>
+#include <exception>
 
-struct PegHeader;
-
-const std::ios::openmode OPENMODE_READ = std::ios::in | std::ios::binary;
-const std::ios::openmode OPENMODE_WRITE = std::ios::out | std::ios::binary | std::ios::trunc;
+#include "../container.hpp"
+#include "../headerfile.hpp"
+#include "../common.hpp"
 
 using commandtype = std::function<int(const std::string&, std::vector<std::string>::const_iterator, std::vector<std::string>::const_iterator)>;
 
-const char* get_stream_error(const std::ios& stream);
-std::string get_data_filename(const std::string& header_filename);
-void align(std::ostream& stream, std::streamoff alignment);
-
-PegHeader read_headerfile(const std::string& filename);
-void write_headerfile(const std::string& filename, PegHeader& header);
-void read_datafile(const std::string& filename, PegHeader& header);
-void write_datafile(const std::string& filename, PegHeader& header);
+// Defined in commands.cpp, maps command names to the cmd_* functions
+const std::unordered_map<std::string, commandtype>& get_commands();
 
 // Defined in cmd_*.cpp files
 
 int cmd_add(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
+int cmd_batch(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
 int cmd_check(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
 int cmd_delete(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
 int cmd_extract(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
+int cmd_generate(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
+int cmd_hash(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
 int cmd_list(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
 int cmd_modify(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
+int cmd_repack(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
+int cmd_serve(std::string progname, std::vector<std::string>::const_iterator beginargs, std::vector<std::string>::const_iterator endargs);
+
+// Defined in cmd_batch.cpp, splits a command line into arguments
+std::vector<std::string> split_args(const std::string& line);
+
+// Defined in cmd_generate.cpp, random test containers. The same options give
+// the same entries, the same seed and entry index the same data.
+
+enum class MipMode
+{
+    Full,
+    None,
+    Random
+};
+
+struct GenerateOptions
+{
+    size_t entries = 100;
+    std::vector<TextureFormat> formats;
+    uint32_t min_size = 64;
+    uint32_t max_size = 1024;
+    MipMode mips = MipMode::Full;
+    bool nonpow2 = false;
+    uint64_t seed = 1;
+    unsigned jobs = 1;
+};
+
+PegHeader generate_entries(const GenerateOptions& options);
+void generate_data(uint64_t seed, size_t entry_i, std::vector<char>& data);
 
-inline void set_ios_exceptions(std::ios& stream)
+// libsrtex throws its errors with the message, the commands print them and
+// exit with status 1
+inline int report_error(const std::exception& e)
 {
-    stream.exceptions(std::ios::badbit | std::ios::failbit);
+    errormsg() << e.what() << std::endl;
+    return 1;
 }
 
 inline std::string help_format(std::string help_str, const std::string& progname)
@@ -0,0 +1,163 @@
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory> // std::shared_ptr
+#include <exception>
+#include <algorithm> // std::find
+#include <functional>
+
+#include "workers.hpp"
+
+static WorkerPool* shared_pool = nullptr;
+
+struct WorkerPool::Job
+{
+    const std::function<void(size_t)>* func;
+    size_t count;
+    size_t next_index;
+    size_t finished;
+    std::vector<std::exception_ptr> errors;
+};
+
+unsigned get_job_count(unsigned jobs)
+{
+    if (jobs == 0) {
+        jobs = std::thread::hardware_concurrency();
+    }
+    return (jobs > 0) ? jobs : 1;
+}
+
+WorkerPool::WorkerPool(unsigned threads)
+{
+    for (unsigned thread_i = 1; thread_i < threads; thread_i++) {
+        m_threads.emplace_back(&WorkerPool::worker_main, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_changed.notify_all();
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)>& func)
+{
+    if (count == 0) {
+        return;
+    }
+
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->func = &func;
+    job->count = count;
+    job->next_index = 0;
+    job->finished = 0;
+    job->errors.resize(count);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queue.push_back(job);
+    m_changed.notify_all();
+
+    while (job->finished < job->count) {
+        // Prefer our own indices, then help with whatever else is queued
+        if (job->next_index < job->count) {
+            size_t index = job->next_index++;
+            if (job->next_index == job->count) {
+                m_queue.erase(std::find(m_queue.begin(), m_queue.end(), job));
+            }
+            execute(job, index, lock);
+            continue;
+        }
+
+        size_t other_index;
+        std::shared_ptr<Job> other_job = claim_any(other_index);
+        if (other_job) {
+            execute(other_job, other_index, lock);
+        } else {
+            m_changed.wait(lock);
+        }
+    }
+    lock.unlock();
+
+    for (const std::exception_ptr& error : job->errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void WorkerPool::worker_main()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        size_t index;
+        std::shared_ptr<Job> job = claim_any(index);
+        if (job) {
+            execute(job, index, lock);
+        } else {
+            m_changed.wait(lock);
+        }
+    }
+}
+
+// Takes the next index of the oldest queued job. Needs the mutex.
+std::shared_ptr<WorkerPool::Job> WorkerPool::claim_any(size_t& index)
+{
+    if (m_queue.empty()) {
+        return nullptr;
+    }
+
+    std::shared_ptr<Job> job = m_queue.front();
+    index = job->next_index++;
+    if (job->next_index == job->count) {
+        m_queue.pop_front();
+    }
+    return job;
+}
+
+// Runs one index with the mutex released
+void WorkerPool::execute(const std::shared_ptr<Job>& job, size_t index,
+    std::unique_lock<std::mutex>& lock)
+{
+    lock.unlock();
+    try {
+        (*job->func)(index);
+    } catch (...) {
+        job->errors[index] = std::current_exception();
+    }
+    lock.lock();
+
+    job->finished++;
+    if (job->finished == job->count) {
+        m_changed.notify_all();
+    }
+}
+
+void set_shared_pool(WorkerPool* pool)
+{
+    shared_pool = pool;
+}
+
+void parallel_for(size_t count, unsigned jobs, const std::function<void(size_t)>& func)
+{
+    if (shared_pool != nullptr) {
+        shared_pool->run(count, func);
+        return;
+    }
+
+    size_t thread_count = get_job_count(jobs);
+    if (thread_count > count) {
+        thread_count = count;
+    }
+
+    WorkerPool pool(static_cast<unsigned>(thread_count));
+    pool.run(count, func);
+}
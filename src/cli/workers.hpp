@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory> // std::shared_ptr
+#include <functional>
+
+// Resolves the -j argument, 0 means one thread per CPU
+unsigned get_job_count(unsigned jobs);
+
+// Set of threads that work through index ranges submitted with run. Threads
+// that wait for their own range to finish help out with other ranges, so
+// ranges can be nested (a batch job extracting its textures) without
+// blocking a thread or starting more threads than the pool has.
+
+class WorkerPool
+{
+public:
+    // The thread calling run counts as one of the threads
+    explicit WorkerPool(unsigned threads);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void run(size_t count, const std::function<void(size_t)>& func);
+
+private:
+    struct Job;
+
+    void worker_main();
+    std::shared_ptr<Job> claim_any(size_t& index);
+    void execute(const std::shared_ptr<Job>& job, size_t index,
+        std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::shared_ptr<Job>> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    bool m_stopping = false;
+};
+
+// Makes parallel_for run on pool instead of starting its own threads. Pass
+// nullptr to go back to the default.
+void set_shared_pool(WorkerPool* pool);
+
+// Calls func for every index in [0, count) using up to `jobs` threads, or
+// the shared pool if one is set. The calling thread does part of the work
+// itself. If func throws, the remaining indices are still processed and the
+// exception of the lowest index is rethrown after all of them have finished.
+void parallel_for(size_t count, unsigned jobs, const std::function<void(size_t)>& func);
@@ -1,20 +1,64 @@
 #pragma once
 #include <iostream>
+#include <sstream> // std::ostringstream
+#include <mutex>
+#include <utility> // std::move
 
 #define MAKEFOURCC(a, b, c, d) ((d << 24) | (c << 16) | (b << 8) | (a << 0))
 #define ARRAYSIZE(a) (sizeof(a) / sizeof(a[0]))
 
-inline std::ostream& errormsg()
+// Collects a message and writes it to stderr in one piece once the statement
+// is done, so messages from different threads don't get mixed up.
+
+class LogLine
+{
+public:
+    explicit LogLine(const char* prefix)
+    {
+        m_buffer << prefix;
+    }
+
+    LogLine(LogLine&& other) :
+        m_buffer(std::move(other.m_buffer))
+    {
+
+    }
+
+    ~LogLine()
+    {
+        static std::mutex output_mutex;
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << m_buffer.str() << std::flush;
+    }
+
+    template<typename T>
+    LogLine& operator<<(const T& value)
+    {
+        m_buffer << value;
+        return *this;
+    }
+
+    LogLine& operator<<(std::ostream& (*manipulator)(std::ostream&))
+    {
+        m_buffer << manipulator;
+        return *this;
+    }
+
+private:
+    std::ostringstream m_buffer;
+};
+
+inline LogLine errormsg()
 {
-    return std::cerr << "[Error] ";
+    return LogLine("[Error] ");
 }
 
-inline std::ostream& warnmsg()
+inline LogLine warnmsg()
 {
-    return std::cerr << "[Warning] ";
+    return LogLine("[Warning] ");
 }
 
-inline std::ostream& infomsg()
+inline LogLine infomsg()
 {
-    return std::cerr << "[Info] ";
+    return LogLine("[Info] ");
 }
@@ -0,0 +1,927 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <exception>
+#include <memory> // std::shared_ptr
+#include <functional>
+#include <map>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm> // std::sort, std::stable_sort, std::stable_partition
+#include <stdexcept> // std::runtime_error
+#include <stdio.h> // remove
+#include <string.h> // memcmp, memcpy, memmove
+
+#include "headerfile.hpp"
+#include "fileio.hpp"
+#include "hash.hpp"
+#include "path.hpp"
+#include "stats.hpp"
+#include "errors.hpp"
+#include "gcc/abi_fix.hpp"
+#include "container.hpp"
+
+std::string get_data_filename(const std::string& header_filename)
+{
+    std::string ext = path::extension(header_filename);
+    std::string root = path::remove_extension(header_filename);
+    if (ext == "cvbm_pc") {
+        return root + ".gvbm_pc";
+    } else if (ext == "cpeg_pc") {
+        return root + ".gpeg_pc";
+    } else {
+        return "";
+    }
+}
+
+const char* get_stream_error(const std::ios& stream)
+{
+    if (stream.eof()) {
+        return "End of file";
+    } else if (stream.bad()) {
+        return "I/O error";
+    } else if (stream.fail()) {
+        return "Unknown error";
+    } else {
+        return "No error";
+    }
+}
+
+
+static std::mutex g_warning_mutex;
+static std::function<void(const std::string&)> g_warning_handler;
+
+void set_warning_handler(std::function<void(const std::string&)> handler)
+{
+    std::lock_guard<std::mutex> lock(g_warning_mutex);
+    g_warning_handler = std::move(handler);
+}
+
+static void report_warning(const std::string& message)
+{
+    std::lock_guard<std::mutex> lock(g_warning_mutex);
+    if (g_warning_handler) {
+        g_warning_handler(message);
+    }
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+
+
+// LRU cache of parsed headers and mapped data files, off by default.
+// Entries are only used while the size and modification time of the file
+// still match.
+
+struct CachedFile
+{
+    std::string filename;
+    int64_t size;
+    int64_t mtime;
+    std::shared_ptr<PegHeader> header;
+    std::shared_ptr<MappedFile> mapping;
+};
+
+static std::mutex g_cache_mutex;
+static size_t g_cache_capacity = 0;
+static std::list<CachedFile> g_cache_list; // Most recently used first
+static std::unordered_map<std::string, std::list<CachedFile>::iterator> g_cache_map;
+
+void enable_container_cache(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    g_cache_capacity = capacity;
+    while (g_cache_list.size() > g_cache_capacity) {
+        g_cache_map.erase(g_cache_list.back().filename);
+        g_cache_list.pop_back();
+    }
+}
+
+void invalidate_container_cache(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    auto found = g_cache_map.find(filename);
+    if (found != g_cache_map.end()) {
+        g_cache_list.erase(found->second);
+        g_cache_map.erase(found);
+    }
+}
+
+static bool find_cached_file(const std::string& filename, CachedFile& cached)
+{
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    auto found = g_cache_map.find(filename);
+    if (found == g_cache_map.end()) {
+        return false;
+    }
+    std::list<CachedFile>::iterator item = found->second;
+    if (item->size != path::file_size(filename) || item->mtime != path::modified_time(filename)) {
+        g_cache_list.erase(item);
+        g_cache_map.erase(found);
+        return false;
+    }
+    g_cache_list.splice(g_cache_list.begin(), g_cache_list, item);
+    cached = *item;
+    return true;
+}
+
+static void add_cached_file(CachedFile cached)
+{
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    if (g_cache_capacity == 0) {
+        return;
+    }
+    auto found = g_cache_map.find(cached.filename);
+    if (found != g_cache_map.end()) {
+        g_cache_list.erase(found->second);
+        g_cache_map.erase(found);
+    }
+    g_cache_list.push_front(std::move(cached));
+    g_cache_map[g_cache_list.front().filename] = g_cache_list.begin();
+    if (g_cache_list.size() > g_cache_capacity) {
+        g_cache_map.erase(g_cache_list.back().filename);
+        g_cache_list.pop_back();
+    }
+}
+
+static bool container_cache_enabled()
+{
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    return g_cache_capacity > 0;
+}
+
+
+
+PegHeader read_headerfile(const std::string& filename)
+{
+    ScopedTimer timer(StatPhase::ReadHeader);
+
+    recover_container(filename);
+
+    CachedFile cached;
+    bool use_cache = container_cache_enabled();
+    if (use_cache) {
+        if (find_cached_file(filename, cached) && cached.header) {
+            return *cached.header;
+        }
+        cached.filename = filename;
+        cached.size = path::file_size(filename);
+        cached.mtime = path::modified_time(filename);
+    }
+
+    // Open header file
+
+    std::ifstream headerfile;
+    set_ios_exceptions(headerfile);
+    try {
+        GCC_ABI_WORKAROUND_START
+        headerfile.open(filename, OPENMODE_READ | std::ios::ate);
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw io_error("Failed to open header file: " + filename);
+    }
+
+    // Read the whole file and parse it from memory
+
+    PegHeader header;
+    try {
+        GCC_ABI_WORKAROUND_START
+        std::vector<char> buffer(static_cast<size_t>(headerfile.tellg()));
+        headerfile.seekg(0);
+        headerfile.read(buffer.data(), buffer.size());
+        headerfile.close();
+        add_counter(StatCounter::BytesRead, buffer.size());
+        header.read(buffer.data(), buffer.size());
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw io_error(std::string("Failed to read header: ") + get_stream_error(headerfile));
+    } catch (const std::exception& e) {
+        throw std::runtime_error(std::string("Failed to read header: ") + e.what());
+    }
+
+    if (use_cache) {
+        cached.header = std::make_shared<PegHeader>(header);
+        add_cached_file(std::move(cached));
+    }
+    return header;
+}
+
+void write_headerfile(const std::string& filename, PegHeader& header)
+{
+    ScopedTimer timer(StatPhase::WriteHeader);
+
+    // Open header file
+
+    std::ofstream headerfile;
+    set_ios_exceptions(headerfile);
+    try {
+        GCC_ABI_WORKAROUND_START
+        headerfile.open(filename, OPENMODE_WRITE);
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw io_error("Failed to open header file for writing: " + filename);
+    }
+
+    invalidate_container_cache(filename);
+
+    // Update header size
+
+    header.dir_block_size = static_cast<uint32_t>(header.size());
+
+    // Write header
+
+    try {
+        GCC_ABI_WORKAROUND_START
+        header.write(headerfile);
+        headerfile.close();
+        add_counter(StatCounter::BytesWritten, header.dir_block_size);
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw io_error(std::string("Failed to write header: ") + get_stream_error(headerfile));
+    } catch (const std::exception& e) {
+        throw io_error(std::string("Failed to write header: ") + e.what());
+    }
+}
+
+void read_datafile(const std::string& filename, PegHeader& header)
+{
+    ScopedTimer timer(StatPhase::ReadData);
+
+    if (header.total_entries == 0) {
+        return;
+    }
+
+    // Open data file
+
+    RawFile datafile;
+    try {
+        datafile.open_read(filename);
+    } catch (const std::exception& e) {
+        throw io_error(std::string("Failed to open data file: ") + e.what());
+    }
+
+    std::vector<size_t> order(header.entries.size());
+    for (size_t entry_i = 0; entry_i < order.size(); entry_i++) {
+        if (header.entries[entry_i].offset < 0) {
+            throw std::runtime_error("Failed to read texture data: Invalid offset");
+        }
+        order[entry_i] = entry_i;
+    }
+    sort_by_offset(header, order);
+    std::vector<DataRange> ranges = merge_data_ranges(header, order);
+
+    // The kernel reads ahead on its own when the reads are sequential, gaps
+    // need the ranges after them announced
+
+    datafile.advise_sequential();
+    std::unique_ptr<Prefetcher> prefetcher;
+    if (is_fragmented(ranges)) {
+        prefetcher.reset(new Prefetcher(get_prefetch_ranges(ranges), PREFETCH_WINDOW,
+            [&datafile](uint64_t offset, uint64_t size) {
+                datafile.will_need(offset, size);
+            }));
+    }
+
+    // Read texture data
+
+    std::vector<char> buffer;
+    try {
+        for (size_t range_i = 0; range_i < ranges.size(); range_i++) {
+            if (prefetcher) {
+                prefetcher->advance(range_i);
+            }
+            const DataRange& range = ranges[range_i];
+            if (range.last - range.first == 1) {
+                PegEntry& entry = header.entries[order[range.first]];
+                std::vector<char> texture_data(entry.data_size);
+                datafile.read_at(range.offset, texture_data.data(), entry.data_size);
+                entry.data = std::move(texture_data);
+                continue;
+            }
+
+            buffer.resize(static_cast<size_t>(range.size));
+            datafile.read_at(range.offset, buffer.data(), buffer.size());
+            for (size_t order_i = range.first; order_i < range.last; order_i++) {
+                PegEntry& entry = header.entries[order[order_i]];
+                const char* start = buffer.data() + (entry.offset - range.offset);
+                entry.data.assign(start, start + entry.data_size);
+            }
+        }
+    } catch (const std::exception& e) {
+        throw io_error(std::string("Failed to read texture data: ") + e.what());
+    }
+}
+
+void sort_by_offset(const PegHeader& header, std::vector<size_t>& indices)
+{
+    std::stable_sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
+        return header.entries[a].offset < header.entries[b].offset;
+    });
+}
+
+std::vector<DataRange> merge_data_ranges(const PegHeader& header,
+    const std::vector<size_t>& order)
+{
+    std::vector<DataRange> ranges;
+    for (size_t order_i = 0; order_i < order.size(); order_i++) {
+        const PegEntry& entry = header.entries[order[order_i]];
+        uint64_t offset = static_cast<uint64_t>(std::max<int64_t>(entry.offset, 0));
+        uint64_t end = offset + entry.data_size;
+        if (!ranges.empty()) {
+            DataRange& last = ranges.back();
+            uint64_t last_end = last.offset + last.size;
+            uint64_t merged_end = std::max(end, last_end);
+            if (offset <= last_end + DATA_RANGE_GAP && merged_end - last.offset <= DATA_RANGE_SIZE) {
+                last.size = merged_end - last.offset;
+                last.last = order_i + 1;
+                continue;
+            }
+        }
+        DataRange range = {offset, end - offset, order_i, order_i + 1};
+        ranges.push_back(range);
+    }
+    return ranges;
+}
+
+bool is_fragmented(const std::vector<DataRange>& ranges)
+{
+    for (size_t range_i = 1; range_i < ranges.size(); range_i++) {
+        const DataRange& previous = ranges[range_i - 1];
+        if (ranges[range_i].offset > previous.offset + previous.size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<Prefetcher::Range> get_prefetch_ranges(const std::vector<DataRange>& ranges)
+{
+    std::vector<Prefetcher::Range> prefetch_ranges;
+    prefetch_ranges.reserve(ranges.size());
+    for (const DataRange& range : ranges) {
+        Prefetcher::Range prefetch_range = {range.offset, range.size};
+        prefetch_ranges.push_back(prefetch_range);
+    }
+    return prefetch_ranges;
+}
+
+std::shared_ptr<MappedFile> map_datafile(const std::string& filename, PegHeader& header)
+{
+    ScopedTimer timer(StatPhase::ReadData);
+
+    if (header.total_entries == 0) {
+        return nullptr;
+    }
+
+    // Map data file, or reuse the mapping of an unchanged file
+
+    std::shared_ptr<MappedFile> datafile;
+    CachedFile cached;
+    bool use_cache = container_cache_enabled();
+    if (use_cache && find_cached_file(filename, cached) && cached.mapping) {
+        datafile = cached.mapping;
+    } else {
+        if (use_cache) {
+            cached.filename = filename;
+            cached.size = path::file_size(filename);
+            cached.mtime = path::modified_time(filename);
+        }
+        datafile = std::make_shared<MappedFile>();
+        try {
+            datafile->open(filename);
+        } catch (const std::exception& e) {
+            throw io_error(std::string("Failed to open data file: ") + e.what());
+        }
+        if (use_cache) {
+            cached.mapping = datafile;
+            add_cached_file(std::move(cached));
+        }
+    }
+
+    // Point entries at their texture data, the mapping has to outlive them
+
+    for (PegEntry& entry : header.entries) {
+        uint64_t data_end = static_cast<uint64_t>(entry.offset) + entry.data_size;
+        if (entry.offset < 0 || data_end > datafile->size()) {
+            throw std::runtime_error("Failed to read texture data: End of file");
+        }
+        entry.mapped_data = datafile->data() + entry.offset;
+    }
+
+    return datafile;
+}
+
+static std::atomic<size_t> g_write_buffer_size(DEFAULT_WRITE_BUFFER_SIZE);
+static std::atomic<bool> g_write_direct(false);
+
+void set_write_buffer(size_t buffer_size, bool direct)
+{
+    g_write_buffer_size = buffer_size;
+    g_write_direct = direct;
+}
+
+DataFileWriter::DataFileWriter(const std::string& filename, uint16_t alignment)
+{
+    m_filename = filename;
+    m_alignment = alignment;
+    open(g_write_buffer_size, g_write_direct);
+}
+
+DataFileWriter::DataFileWriter(const std::string& filename, uint16_t alignment,
+    size_t buffer_size, bool direct)
+{
+    m_filename = filename;
+    m_alignment = alignment;
+    open(buffer_size, direct);
+}
+
+void DataFileWriter::open(size_t buffer_size, bool direct)
+{
+    m_temp_filename = m_filename + ".tmp";
+    try {
+        m_file.open_write(m_temp_filename);
+    } catch (const std::exception& e) {
+        throw io_error(std::string("Failed to open data file for writing: ") + e.what());
+    }
+
+    if (direct) {
+        m_direct = m_file.set_direct(true);
+        if (!m_direct) {
+            report_warning("Direct I/O isn't supported for " + m_filename);
+        }
+    }
+
+    // Direct writes need whole blocks from an aligned address
+    m_buffer_size = std::max(align_up(buffer_size, DIRECT_IO_ALIGNMENT),
+        static_cast<uint64_t>(DIRECT_IO_ALIGNMENT));
+    m_buffer_storage.resize(m_buffer_size + DIRECT_IO_ALIGNMENT);
+    uintptr_t address = reinterpret_cast<uintptr_t>(m_buffer_storage.data());
+    m_buffer = m_buffer_storage.data() + (align_up(address, DIRECT_IO_ALIGNMENT) - address);
+}
+
+DataFileWriter::~DataFileWriter()
+{
+    if (!m_finished) {
+        m_file.close();
+        remove(m_temp_filename.c_str());
+    }
+}
+
+int64_t DataFileWriter::write(const char* data, size_t size)
+{
+    uint64_t offset = align();
+    if (!m_direct && size >= m_buffer_size) {
+        flush(true);
+        m_file.write(data, size);
+        m_position += size;
+    } else {
+        buffer_data(data, size);
+    }
+    return static_cast<int64_t>(offset);
+}
+
+int64_t DataFileWriter::copy(RawFile& source, uint64_t source_offset, size_t size)
+{
+    uint64_t offset = align();
+    if (!m_direct && size >= m_buffer_size) {
+        flush(true);
+        copy_range(source, source_offset, m_file, size);
+        m_position += size;
+        return static_cast<int64_t>(offset);
+    }
+
+    // Small entries are read into the buffer to be written together, direct
+    // writes always go through it
+    size_t copied = 0;
+    while (copied < size) {
+        if (m_buffered == m_buffer_size) {
+            flush(false);
+        }
+        size_t chunk = std::min(size - copied, m_buffer_size - m_buffered);
+        source.read_at(source_offset + copied, m_buffer + m_buffered, chunk);
+        m_buffered += chunk;
+        m_position += chunk;
+        copied += chunk;
+    }
+    return static_cast<int64_t>(offset);
+}
+
+uint64_t DataFileWriter::size() const
+{
+    return m_position;
+}
+
+void DataFileWriter::finish()
+{
+    flush(true);
+    m_file.close();
+    invalidate_container_cache(m_filename);
+    replace_file(m_temp_filename, m_filename);
+    m_finished = true;
+}
+
+// Padding is written as zeros, so the file has no holes
+uint64_t DataFileWriter::align()
+{
+    static const char zeros[4096] = {};
+    uint64_t offset = align_up(m_position, m_alignment);
+    while (m_position < offset) {
+        buffer_data(zeros, static_cast<size_t>(std::min<uint64_t>(offset - m_position, sizeof(zeros))));
+    }
+    return offset;
+}
+
+void DataFileWriter::buffer_data(const char* data, size_t size)
+{
+    while (size > 0) {
+        if (m_buffered == m_buffer_size) {
+            flush(false);
+        }
+        size_t chunk = std::min(size, m_buffer_size - m_buffered);
+        memcpy(m_buffer + m_buffered, data, chunk);
+        m_buffered += chunk;
+        m_position += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+// Direct I/O only writes whole blocks, the rest stays in the buffer until
+// the end of the file, which is written with direct I/O turned off
+void DataFileWriter::flush(bool all)
+{
+    size_t write_size = m_buffered;
+    if (m_direct) {
+        write_size -= m_buffered % DIRECT_IO_ALIGNMENT;
+    }
+    m_file.write(m_buffer, write_size);
+    if (all && write_size < m_buffered) {
+        m_file.set_direct(false);
+        m_direct = false;
+        m_file.write(m_buffer + write_size, m_buffered - write_size);
+        write_size = m_buffered;
+    }
+    memmove(m_buffer, m_buffer + write_size, m_buffered - write_size);
+    m_buffered -= write_size;
+}
+
+// Rebuilds the data file. Entries that have their data loaded are written
+// from memory, all others are copied straight from source_filename at their
+// current offset. The new file is written next to the old one and moved over
+// it at the end, so source and destination can be the same file.
+// Entries sharing their data in the source keep sharing it. With dedup all
+// entries with identical data share one copy.
+
+void write_datafile(const std::string& filename, PegHeader& header,
+    const std::string& source_filename, bool dedup)
+{
+    ScopedTimer timer(StatPhase::WriteData);
+
+    // Open source file if there's anything to copy. Dedup compares the data
+    // of every entry, so the source gets mapped instead.
+
+    RawFile source;
+    MappedFile source_map;
+    for (const PegEntry& entry : header.entries) {
+        if (!entry.has_data() && entry.data_size > 0) {
+            if (source_filename.empty()) {
+                throw std::runtime_error("No texture data for " + entry.filename);
+            }
+            try {
+                if (dedup) {
+                    source_map.open(source_filename);
+                } else {
+                    source.open_read(source_filename);
+                }
+            } catch (const std::exception& e) {
+                throw io_error(std::string("Failed to open data file: ") + e.what());
+            }
+            break;
+        }
+    }
+
+    DataFileWriter datafile(filename, header.alignment);
+
+    std::map<std::pair<int64_t, uint32_t>, int64_t> copied_slots; // Source slot to new offset
+    std::unordered_map<uint64_t, std::vector<size_t>> written_hashes; // Hash to entry indices
+    std::vector<const char*> entry_data(header.entries.size());
+
+    try {
+        for (size_t entry_i = 0; entry_i < header.entries.size(); entry_i++) {
+            PegEntry& entry = header.entries[entry_i];
+
+            // Look for data that was already written
+
+            const char* data = entry.has_data() ? entry.texture_data() : nullptr;
+            std::pair<int64_t, uint32_t> source_slot(entry.offset, entry.data_size);
+            if (dedup) {
+                if (data == nullptr) {
+                    uint64_t data_end = static_cast<uint64_t>(entry.offset) + entry.data_size;
+                    if (entry.offset < 0 || data_end > source_map.size()) {
+                        throw std::runtime_error("Texture data of " + entry.filename +
+                            " is outside of the source file");
+                    }
+                    data = source_map.data() + entry.offset;
+                }
+                entry_data[entry_i] = data;
+
+                std::vector<size_t>& same_hash = written_hashes[hash_data(data, entry.data_size)];
+                bool shared = false;
+                for (size_t other_i : same_hash) {
+                    const PegEntry& other = header.entries[other_i];
+                    if (other.data_size == entry.data_size &&
+                            memcmp(entry_data[other_i], data, entry.data_size) == 0) {
+                        entry.offset = other.offset;
+                        shared = true;
+                        break;
+                    }
+                }
+                if (shared) {
+                    continue;
+                }
+                same_hash.push_back(entry_i);
+            } else if (data == nullptr) {
+                auto slot = copied_slots.find(source_slot);
+                if (slot != copied_slots.end()) {
+                    entry.offset = slot->second;
+                    continue;
+                }
+            }
+
+            // Write entry
+
+            if (data != nullptr) {
+                entry.offset = datafile.write(data, entry.data_size);
+            } else {
+                int64_t offset = datafile.copy(source, entry.offset, entry.data_size);
+                copied_slots[source_slot] = offset;
+                entry.offset = offset;
+            }
+        }
+
+        header.data_block_size = static_cast<uint32_t>(datafile.size());
+        source.close();
+        source_map.close();
+        datafile.finish();
+    } catch (const std::exception& e) {
+        throw io_error(std::string("Failed to write data file: ") + e.what());
+    }
+}
+
+// Appends the entries that have data loaded to an existing data file. The
+// old data stays where it is, because the header on disk still points at it
+// until the new header is committed, so an interrupted patch leaves the old
+// container intact. The space of replaced textures is reclaimed by repack.
+// The file has to be synced before the header is replaced.
+
+void patch_datafile(const std::string& filename, PegHeader& header)
+{
+    ScopedTimer timer(StatPhase::WriteData);
+
+    invalidate_container_cache(filename);
+
+    // Open data file without truncating it
+
+    std::fstream datafile;
+    set_ios_exceptions(datafile);
+    try {
+        GCC_ABI_WORKAROUND_START
+        datafile.open(filename, OPENMODE_PATCH);
+        GCC_ABI_WORKAROUND_END
+    } catch (std::ios::failure) {
+        throw io_error("Failed to open data file for writing: " + filename);
+    }
+
+    // Append after everything that is already there, data_block_size can be
+    // below the end of the file or of entries written by another tool
+
+    uint64_t data_end = static_cast<uint64_t>(std::max<int64_t>(path::file_size(filename), 0));
+    for (const PegEntry& entry : header.entries) {
+        if (entry.offset >= 0 && !entry.has_data()) {
+            data_end = std::max<uint64_t>(data_end, static_cast<uint64_t>(entry.offset) + entry.data_size);
+        }
+    }
+    data_end = align_up(std::max<uint64_t>(data_end, header.data_block_size), header.alignment);
+
+    for (PegEntry& entry : header.entries) {
+        if (!entry.has_data()) {
+            continue;
+        }
+
+        entry.offset = static_cast<int64_t>(data_end);
+        data_end = align_up(data_end + entry.data_size, header.alignment);
+        header.data_block_size = static_cast<uint32_t>(entry.offset + entry.data_size);
+
+        // Write entry
+
+        try {
+            GCC_ABI_WORKAROUND_START
+            datafile.seekp(entry.offset);
+            datafile.write(entry.texture_data(), entry.data_size);
+            GCC_ABI_WORKAROUND_END
+            add_counter(StatCounter::BytesWritten, entry.data_size);
+        } catch (std::ios::failure) {
+            throw io_error(std::string("Failed to write data file: ") + get_stream_error(datafile));
+        }
+    }
+
+    datafile.close();
+}
+
+
+
+static std::atomic<bool> g_journal_enabled(false);
+
+void set_container_journal(bool enabled)
+{
+    g_journal_enabled = enabled;
+}
+
+std::string get_journal_filename(const std::string& header_filename)
+{
+    return header_filename + ".journal";
+}
+
+std::string get_lock_filename(const std::string& header_filename)
+{
+    return header_filename + ".lock";
+}
+
+static std::string in_directory(const std::string& dirname, const std::string& filename)
+{
+    return dirname.empty() ? filename : path::join(dirname, filename);
+}
+
+ContainerCommit::ContainerCommit(const std::string& header_filename)
+{
+    m_header_filename = header_filename;
+}
+
+ContainerCommit::~ContainerCommit()
+{
+    // Once the journal is complete or a file was renamed, the temporary
+    // files are needed to finish the commit on the next read
+    if (!m_committed && !m_keep_files) {
+        for (const auto& file : m_files) {
+            remove(file.first.c_str());
+        }
+    }
+}
+
+std::string ContainerCommit::add_file(const std::string& filename)
+{
+    std::string temp_filename = filename + ".new";
+    m_files.emplace_back(temp_filename, filename);
+    return temp_filename;
+}
+
+void ContainerCommit::add_appended_file(const std::string& filename)
+{
+    m_appended_files.push_back(filename);
+}
+
+// The journal holds one line per rename with the names relative to the
+// directory of the header, and a last line "end" once it's complete:
+//   <temporary name>\t<real name>
+// It's written under another name and renamed into place, and commit and
+// recovery both hold the lock on <header>.lock while they use it.
+
+void ContainerCommit::commit()
+{
+    std::string dirname = path::dirname(m_header_filename);
+    std::string journal_filename = get_journal_filename(m_header_filename);
+    std::string journal_temp_filename = journal_filename + ".tmp";
+    bool use_journal = g_journal_enabled;
+
+    // The header goes last, so a data file is never newer than its header
+    std::stable_partition(m_files.begin(), m_files.end(),
+        [&](const std::pair<std::string, std::string>& file) {
+            return file.second != m_header_filename;
+        });
+
+    try {
+        for (const auto& file : m_files) {
+            sync_file(file.first);
+        }
+        for (const std::string& filename : m_appended_files) {
+            sync_file(filename);
+        }
+
+        std::unique_ptr<FileLock> lock;
+        if (use_journal) {
+            lock.reset(new FileLock(get_lock_filename(m_header_filename)));
+
+            std::ofstream journal;
+            set_ios_exceptions(journal);
+            GCC_ABI_WORKAROUND_START
+            journal.open(journal_temp_filename, OPENMODE_WRITE);
+            for (const auto& file : m_files) {
+                journal << path::basename(file.first) << "\t" << path::basename(file.second) << "\n";
+            }
+            journal << "end\n";
+            journal.close();
+            GCC_ABI_WORKAROUND_END
+            sync_file(journal_temp_filename);
+            replace_file(journal_temp_filename, journal_filename);
+            sync_directory(dirname);
+            m_keep_files = true;
+        }
+
+        for (const auto& file : m_files) {
+            invalidate_container_cache(file.second);
+            replace_file(file.first, file.second);
+            m_keep_files = true;
+        }
+        sync_directory(dirname);
+        m_committed = true;
+
+        if (use_journal) {
+            remove(journal_filename.c_str());
+        }
+    } catch (std::ios::failure) {
+        remove(journal_temp_filename.c_str());
+        throw io_error("Failed to write journal: " + journal_filename);
+    } catch (const std::exception& e) {
+        if (!m_keep_files) {
+            remove(journal_temp_filename.c_str());
+        }
+        throw io_error(std::string("Failed to replace container: ") + e.what());
+    }
+}
+
+bool recover_container(const std::string& header_filename)
+{
+    std::string journal_filename = get_journal_filename(header_filename);
+    if (!path::exists(journal_filename)) {
+        return false;
+    }
+
+    // A commit that is still running holds the lock until it removed the
+    // journal, so only a journal left behind by a dead process is recovered
+
+    std::unique_ptr<FileLock> lock;
+    try {
+        lock.reset(new FileLock(get_lock_filename(header_filename)));
+    } catch (const std::exception& e) {
+        throw io_error(std::string("Failed to recover interrupted write: ") + e.what());
+    }
+    if (!path::exists(journal_filename)) {
+        return false;
+    }
+
+    std::vector<std::pair<std::string, std::string>> files;
+    bool complete = false;
+    std::ifstream journal(journal_filename);
+    std::string line;
+    while (std::getline(journal, line)) {
+        if (line == "end") {
+            complete = true;
+            break;
+        }
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos) {
+            files.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+        }
+    }
+    journal.close();
+
+    // A complete journal means all new files are on disk, so the renames are
+    // finished. Otherwise the old files are still untouched and the new ones
+    // are dropped.
+
+    std::string dirname = path::dirname(header_filename);
+    try {
+        for (const auto& file : files) {
+            std::string temp_filename = in_directory(dirname, file.first);
+            std::string filename = in_directory(dirname, file.second);
+            if (!path::exists(temp_filename)) {
+                continue;
+            }
+            invalidate_container_cache(filename);
+            if (complete) {
+                replace_file(temp_filename, filename);
+            } else {
+                remove(temp_filename.c_str());
+            }
+        }
+        sync_directory(dirname);
+    } catch (const std::exception& e) {
+        throw io_error(std::string("Failed to recover interrupted write: ") + e.what());
+    }
+    remove(journal_filename.c_str());
+
+    if (complete) {
+        report_warning("Finished interrupted write of " + header_filename);
+    } else {
+        report_warning("Discarded interrupted write of " + header_filename);
+    }
+    return true;
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <ios>
+#include <memory> // std::shared_ptr
+#include <functional>
+
+#include "fileio.hpp"
+
+// Reading and writing whole containers, a header file with its data file.
+// Failures are thrown as io_error, or std::runtime_error for broken headers,
+// with a message naming the file. Nothing is written to stdout or stderr.
+
+struct PegHeader;
+
+const std::ios::openmode OPENMODE_READ = std::ios::in | std::ios::binary;
+const std::ios::openmode OPENMODE_WRITE = std::ios::out | std::ios::binary | std::ios::trunc;
+const std::ios::openmode OPENMODE_PATCH = std::ios::in | std::ios::out | std::ios::binary;
+
+// Receives warnings, like an interrupted commit that was finished or direct
+// I/O that isn't supported. Warnings are dropped while no handler is set.
+void set_warning_handler(std::function<void(const std::string&)> handler);
+
+const char* get_stream_error(const std::ios& stream);
+std::string get_data_filename(const std::string& header_filename);
+
+PegHeader read_headerfile(const std::string& filename);
+void write_headerfile(const std::string& filename, PegHeader& header);
+// Reads the data of all entries in file order, with entries that are close
+// together read at once
+void read_datafile(const std::string& filename, PegHeader& header);
+std::shared_ptr<MappedFile> map_datafile(const std::string& filename, PegHeader& header);
+
+// Entries in order[first, last) with data close enough to read at once
+struct DataRange
+{
+    uint64_t offset;
+    uint64_t size;
+    size_t first;
+    size_t last;
+};
+
+const uint64_t DATA_RANGE_GAP = 64 * 1024; // Largest gap read over
+const uint64_t DATA_RANGE_SIZE = 8 * 1024 * 1024;
+const uint64_t PREFETCH_WINDOW = 64 * 1024 * 1024;
+
+// Sorts entry indices by the offset of their data
+void sort_by_offset(const PegHeader& header, std::vector<size_t>& indices);
+// Groups entry indices that are sorted by offset into ranges
+std::vector<DataRange> merge_data_ranges(const PegHeader& header,
+    const std::vector<size_t>& order);
+// True if the ranges have gaps between them, so reading them one after the
+// other isn't sequential
+bool is_fragmented(const std::vector<DataRange>& ranges);
+std::vector<Prefetcher::Range> get_prefetch_ranges(const std::vector<DataRange>& ranges);
+const size_t DEFAULT_WRITE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+// Writes a data file entry by entry, every entry starts at the alignment.
+// Entries and the zero padding between them are collected in a buffer and
+// written in large blocks, entries bigger than the buffer are written
+// directly. With direct I/O all writes bypass the page cache.
+// The data goes to a temporary file that finish moves over filename, so a
+// failed write leaves the old file alone. I/O errors are thrown as io_error.
+class DataFileWriter
+{
+public:
+    // Uses the buffer settings from set_write_buffer
+    DataFileWriter(const std::string& filename, uint16_t alignment);
+    DataFileWriter(const std::string& filename, uint16_t alignment,
+        size_t buffer_size, bool direct);
+    ~DataFileWriter();
+    DataFileWriter(const DataFileWriter&) = delete;
+    DataFileWriter& operator=(const DataFileWriter&) = delete;
+
+    // Both return the offset the data was written to
+    int64_t write(const char* data, size_t size);
+    int64_t copy(RawFile& source, uint64_t source_offset, size_t size);
+    uint64_t size() const;
+    void finish();
+
+private:
+    void open(size_t buffer_size, bool direct);
+    uint64_t align();
+    void buffer_data(const char* data, size_t size);
+    void flush(bool all);
+
+    std::string m_filename;
+    std::string m_temp_filename;
+    uint16_t m_alignment;
+    RawFile m_file;
+    std::vector<char> m_buffer_storage;
+    char* m_buffer = nullptr; // Aligned for direct I/O
+    size_t m_buffer_size = 0;
+    size_t m_buffered = 0;
+    uint64_t m_position = 0;
+    bool m_direct = false;
+    bool m_finished = false;
+};
+
+// Buffer size and direct I/O for data files written afterwards
+void set_write_buffer(size_t buffer_size, bool direct);
+
+void write_datafile(const std::string& filename, PegHeader& header,
+    const std::string& source_filename = "", bool dedup = false);
+// Appends loaded entries to an existing data file without touching old data
+void patch_datafile(const std::string& filename, PegHeader& header);
+
+// Replaces the files of a container together. The new files are written to
+// the temporary names returned by add_file, commit syncs them to disk and
+// renames them over the real files, the header last. Temporary files are
+// removed if commit fails before the journal is complete or the first file is
+// renamed, after that they are left for recovery.
+// With the journal enabled, commit first records the renames in
+// <header>.journal, and read_headerfile finishes the renames of a commit
+// that was interrupted. Both lock <header>.lock meanwhile, so a reader never
+// touches the files of a commit that is still running. Without the journal a
+// crash between the renames can leave the new data file with the old header.
+class ContainerCommit
+{
+public:
+    explicit ContainerCommit(const std::string& header_filename);
+    ~ContainerCommit();
+    ContainerCommit(const ContainerCommit&) = delete;
+    ContainerCommit& operator=(const ContainerCommit&) = delete;
+
+    // Files have to be in the directory of the header
+    std::string add_file(const std::string& filename);
+    // A file that was only appended to in place, like by patch_datafile. The
+    // old files don't use the new data, so it only gets synced before the
+    // renames.
+    void add_appended_file(const std::string& filename);
+    void commit();
+
+private:
+    std::string m_header_filename;
+    std::vector<std::pair<std::string, std::string>> m_files; // Temporary and real name
+    std::vector<std::string> m_appended_files;
+    bool m_committed = false;
+    bool m_keep_files = false;
+};
+
+void set_container_journal(bool enabled);
+std::string get_journal_filename(const std::string& header_filename);
+std::string get_lock_filename(const std::string& header_filename);
+// Finishes or discards an interrupted commit, returns false if there was none
+bool recover_container(const std::string& header_filename);
+
+// Keeps the parsed headers and data file mappings of the last capacity files
+// that were read, for processes that work on the same containers many times.
+// A cached file is only used while its size and modification time are
+// unchanged, writing a file through these functions drops it. 0 disables the
+// cache, which is the default.
+void enable_container_cache(size_t capacity);
+void invalidate_container_cache(const std::string& filename);
+
+inline void set_ios_exceptions(std::ios& stream)
+{
+    stream.exceptions(std::ios::badbit | std::ios::failbit);
+}
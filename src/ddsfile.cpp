@@ -1,8 +1,10 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <string>
+#include <iostream>
 
 #include "common.hpp"
-#include "byteio.hpp"
+#include "binlayout.hpp"
 #include "errors.hpp"
 #include "headerfile.hpp"
 #include "ddsfile.hpp"
@@ -76,87 +78,83 @@ TextureFormat detect_pixelformat(const DDSPixelformat& ddspf)
 
 
 
+typedef Layout<DDSPixelformat,
+    LAYOUT_FIELD(DDSPixelformat, size),
+    LAYOUT_FIELD(DDSPixelformat, flags),
+    LAYOUT_FIELD(DDSPixelformat, four_cc),
+    LAYOUT_FIELD(DDSPixelformat, rgb_bit_count),
+    LAYOUT_FIELD(DDSPixelformat, r_bitmask),
+    LAYOUT_FIELD(DDSPixelformat, g_bitmask),
+    LAYOUT_FIELD(DDSPixelformat, b_bitmask),
+    LAYOUT_FIELD(DDSPixelformat, a_bitmask)
+> DDSPixelformatLayout;
+static_assert(DDSPixelformatLayout::size == DDS_PIXELFORMAT_SIZE, "DDSPixelformat layout size mismatch");
+
+// The signature isn't part of the header size, it's handled separately
+typedef Layout<DDSHeader,
+    LAYOUT_FIELD(DDSHeader, size),
+    LAYOUT_FIELD(DDSHeader, flags),
+    LAYOUT_FIELD(DDSHeader, height),
+    LAYOUT_FIELD(DDSHeader, width),
+    LAYOUT_FIELD(DDSHeader, pitch_or_linear_size),
+    LAYOUT_FIELD(DDSHeader, depth),
+    LAYOUT_FIELD(DDSHeader, mipmap_count),
+    LAYOUT_ARRAY(DDSHeader, reserved1),
+    LAYOUT_NESTED(DDSHeader, ddspf, DDSPixelformatLayout),
+    LAYOUT_FIELD(DDSHeader, caps),
+    LAYOUT_FIELD(DDSHeader, caps2),
+    LAYOUT_FIELD(DDSHeader, caps3),
+    LAYOUT_FIELD(DDSHeader, caps4),
+    LAYOUT_FIELD(DDSHeader, reserved2)
+> DDSHeaderLayout;
+static_assert(DDSHeaderLayout::size == DDS_HEADER_SIZE, "DDSHeader layout size mismatch");
+
+const size_t DDS_SIGNATURE_SIZE = 4;
+
+
+
 void DDSPixelformat::read(std::istream& stream)
 {
-    ByteReader reader(stream);
+    char buffer[DDS_PIXELFORMAT_SIZE];
+    stream.read(buffer, DDS_PIXELFORMAT_SIZE);
+    DDSPixelformatLayout::read(*this, buffer, ByteOrder::Little);
 
-    size = reader.readU32();
     if (size != DDS_PIXELFORMAT_SIZE) {
         throw field_error("size", std::to_string(size));
     }
-    flags = reader.readU32();
-    four_cc = reader.readU32();
-    rgb_bit_count = reader.readU32();
-    r_bitmask = reader.readU32();
-    g_bitmask = reader.readU32();
-    b_bitmask = reader.readU32();
-    a_bitmask = reader.readU32();
 }
 
 void DDSPixelformat::write(std::ostream& stream) const
 {
-    ByteWriter writer(stream);
-
-    writer.writeU32(size);
-    writer.writeU32(flags);
-    writer.writeU32(four_cc);
-    writer.writeU32(rgb_bit_count);
-    writer.writeU32(r_bitmask);
-    writer.writeU32(g_bitmask);
-    writer.writeU32(b_bitmask);
-    writer.writeU32(a_bitmask);
+    char buffer[DDS_PIXELFORMAT_SIZE];
+    DDSPixelformatLayout::write(*this, buffer, ByteOrder::Little);
+    stream.write(buffer, DDS_PIXELFORMAT_SIZE);
 }
 
 
 
 void DDSHeader::read(std::istream& stream)
 {
-    ByteReader reader(stream);
+    char buffer[DDS_SIGNATURE_SIZE + DDS_HEADER_SIZE];
+    stream.read(buffer, sizeof(buffer));
 
-    signature = reader.readU32();
+    signature = load_value<uint32_t>(buffer, ByteOrder::Little);
     if (signature != FOURCC_DDS) {
         throw field_error("signature", std::string(reinterpret_cast<char*>(&signature), 4));
     }
-    size = reader.readU32();
+    DDSHeaderLayout::read(*this, buffer + DDS_SIGNATURE_SIZE, ByteOrder::Little);
     if (size != DDS_HEADER_SIZE) {
         throw field_error("size", std::to_string(size));
     }
-    flags = reader.readU32();
-    height = reader.readU32();
-    width = reader.readU32();
-    pitch_or_linear_size = reader.readU32();
-    depth = reader.readU32();
-    mipmap_count = reader.readU32();
-    for (size_t i = 0; i < ARRAYSIZE(reserved1); i++) {
-        reserved1[i] = reader.readU32();
+    if (ddspf.size != DDS_PIXELFORMAT_SIZE) {
+        throw field_error("size", std::to_string(ddspf.size));
     }
-    ddspf.read(stream);
-    caps = reader.readU32();
-    caps2 = reader.readU32();
-    caps3 = reader.readU32();
-    caps4 = reader.readU32();
-    reserved2 = reader.readU32();
 }
 
 void DDSHeader::write(std::ostream& stream) const
 {
-    ByteWriter writer(stream);
-
-    writer.writeU32(signature);
-    writer.writeU32(size);
-    writer.writeU32(flags);
-    writer.writeU32(height);
-    writer.writeU32(width);
-    writer.writeU32(pitch_or_linear_size);
-    writer.writeU32(depth);
-    writer.writeU32(mipmap_count);
-    for (size_t i = 0; i < ARRAYSIZE(reserved1); i++) {
-        writer.writeU32(reserved1[i]);
-    }
-    ddspf.write(stream);
-    writer.writeU32(caps);
-    writer.writeU32(caps2);
-    writer.writeU32(caps3);
-    writer.writeU32(caps4);
-    writer.writeU32(reserved2);
+    char buffer[DDS_SIGNATURE_SIZE + DDS_HEADER_SIZE];
+    store_value<uint32_t>(buffer, signature, ByteOrder::Little);
+    DDSHeaderLayout::write(*this, buffer + DDS_SIGNATURE_SIZE, ByteOrder::Little);
+    stream.write(buffer, sizeof(buffer));
 }
@@ -0,0 +1,881 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h> // memcpy
+#include <float.h> // FLT_MAX
+#include <stdlib.h> // abs
+#include <math.h> // sqrtf, fabsf
+#include <algorithm> // std::min, std::max, std::swap
+
+#include "simd.hpp"
+#include "dxt.hpp"
+
+typedef void (*DecodeBlockFunc)(DXTFormat fmt, const uint8_t* block, uint8_t* pixels);
+
+// Colors of a block to encode, split by channel so 4 pixels fit a register
+struct BlockColors
+{
+    alignas(16) float r[16];
+    alignas(16) float g[16];
+    alignas(16) float b[16];
+    alignas(16) float weight[16]; // 0 for pixels that are transparent in DXT1
+};
+
+// Picks the closest palette color for every pixel and returns the weighted
+// sum of the squared distances
+typedef float (*FitIndicesFunc)(const BlockColors& colors, const float palette[4][3],
+    uint8_t indices[16]);
+
+size_t get_block_size(DXTFormat fmt)
+{
+    return (fmt == DXTFormat::DXT1) ? DXT1_BLOCK_SIZE : DXT3_BLOCK_SIZE;
+}
+
+static uint32_t load_le16(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static uint32_t load_le32(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+        (static_cast<uint32_t>(data[3]) << 24);
+}
+
+// Expands an R5G6B5 color to 8 bits per channel by repeating the high bits
+static void expand_565(uint32_t color, uint32_t rgb[3])
+{
+    uint32_t r = (color >> 11) & 0x1F;
+    uint32_t g = (color >> 5) & 0x3F;
+    uint32_t b = color & 0x1F;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Fills palette with the 4 colors of a color block. DXT1 blocks whose first
+// color is not the larger one use 3 colors and transparent black.
+static void build_color_palette(const uint8_t* color_block, bool dxt1, uint8_t palette[4][4])
+{
+    uint32_t color0 = load_le16(color_block);
+    uint32_t color1 = load_le16(color_block + 2);
+
+    uint32_t c0[3];
+    uint32_t c1[3];
+    expand_565(color0, c0);
+    expand_565(color1, c1);
+
+    bool four_colors = !dxt1 || (color0 > color1);
+    for (int ch = 0; ch < 3; ch++) {
+        palette[0][ch] = static_cast<uint8_t>(c0[ch]);
+        palette[1][ch] = static_cast<uint8_t>(c1[ch]);
+        if (four_colors) {
+            palette[2][ch] = static_cast<uint8_t>((2 * c0[ch] + c1[ch]) / 3);
+            palette[3][ch] = static_cast<uint8_t>((c0[ch] + 2 * c1[ch]) / 3);
+        } else {
+            palette[2][ch] = static_cast<uint8_t>((c0[ch] + c1[ch]) / 2);
+            palette[3][ch] = 0;
+        }
+    }
+    palette[0][3] = 0xFF;
+    palette[1][3] = 0xFF;
+    palette[2][3] = 0xFF;
+    palette[3][3] = four_colors ? 0xFF : 0;
+}
+
+// Fills palette with the 8 alpha values of a DXT5 alpha block
+static void build_alpha_palette(const uint8_t* alpha_block, uint8_t palette[8])
+{
+    uint32_t alpha0 = alpha_block[0];
+    uint32_t alpha1 = alpha_block[1];
+    palette[0] = static_cast<uint8_t>(alpha0);
+    palette[1] = static_cast<uint8_t>(alpha1);
+    if (alpha0 > alpha1) {
+        for (uint32_t i = 1; i < 7; i++) {
+            palette[i + 1] = static_cast<uint8_t>(((7 - i) * alpha0 + i * alpha1) / 7);
+        }
+    } else {
+        for (uint32_t i = 1; i < 5; i++) {
+            palette[i + 1] = static_cast<uint8_t>(((5 - i) * alpha0 + i * alpha1) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 0xFF;
+    }
+}
+
+// 16 alpha values of a DXT3 or DXT5 block
+static void decode_alpha_values(DXTFormat fmt, const uint8_t* block, uint8_t alpha[16])
+{
+    if (fmt == DXTFormat::DXT3) {
+        for (size_t i = 0; i < 16; i++) {
+            uint32_t value = (block[i / 2] >> (4 * (i & 1))) & 0xF;
+            alpha[i] = static_cast<uint8_t>(value * 17);
+        }
+    } else {
+        uint8_t palette[8];
+        build_alpha_palette(block, palette);
+        uint64_t indices = 0;
+        for (size_t byte_i = 0; byte_i < 6; byte_i++) {
+            indices |= static_cast<uint64_t>(block[2 + byte_i]) << (8 * byte_i);
+        }
+        for (size_t i = 0; i < 16; i++) {
+            alpha[i] = palette[(indices >> (3 * i)) & 0x7];
+        }
+    }
+}
+
+static void decode_block_scalar(DXTFormat fmt, const uint8_t* block, uint8_t* pixels)
+{
+    const uint8_t* color_block = (fmt == DXTFormat::DXT1) ? block : block + 8;
+    uint8_t palette[4][4];
+    build_color_palette(color_block, fmt == DXTFormat::DXT1, palette);
+
+    uint32_t indices = load_le32(color_block + 4);
+    for (size_t i = 0; i < 16; i++) {
+        memcpy(pixels + i * 4, palette[(indices >> (2 * i)) & 0x3], 4);
+    }
+
+    if (fmt != DXTFormat::DXT1) {
+        uint8_t alpha[16];
+        decode_alpha_values(fmt, block, alpha);
+        for (size_t i = 0; i < 16; i++) {
+            pixels[i * 4 + 3] = alpha[i];
+        }
+    }
+}
+
+#ifdef X86_SIMD
+
+// The SIMD paths treat an RGBA8 pixel as a little endian uint32, which is
+// fine because they only exist on x86.
+
+// Selects palette entries with compares, SSE2 has no variable shuffle
+TARGET_SSE2
+static void decode_block_sse2(DXTFormat fmt, const uint8_t* block, uint8_t* pixels)
+{
+    const uint8_t* color_block = (fmt == DXTFormat::DXT1) ? block : block + 8;
+    uint32_t palette[4];
+    build_color_palette(color_block, fmt == DXTFormat::DXT1,
+        reinterpret_cast<uint8_t(*)[4]>(palette));
+
+    const __m128i pal0 = _mm_set1_epi32(static_cast<int>(palette[0]));
+    const __m128i pal1 = _mm_set1_epi32(static_cast<int>(palette[1]));
+    const __m128i pal2 = _mm_set1_epi32(static_cast<int>(palette[2]));
+    const __m128i pal3 = _mm_set1_epi32(static_cast<int>(palette[3]));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+    const __m128i three = _mm_set1_epi32(3);
+
+    __m128i rows[4];
+    for (size_t row = 0; row < 4; row++) {
+        uint32_t bits = color_block[4 + row];
+        __m128i idx = _mm_setr_epi32(static_cast<int>(bits & 0x3),
+            static_cast<int>((bits >> 2) & 0x3), static_cast<int>((bits >> 4) & 0x3),
+            static_cast<int>(bits >> 6));
+        __m128i result = _mm_and_si128(_mm_cmpeq_epi32(idx, zero), pal0);
+        result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi32(idx, one), pal1));
+        result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi32(idx, two), pal2));
+        result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi32(idx, three), pal3));
+        rows[row] = result;
+    }
+
+    if (fmt != DXTFormat::DXT1) {
+        uint8_t alpha[16];
+        decode_alpha_values(fmt, block, alpha);
+        // Move every alpha byte to the top byte of its 32 bit lane
+        const __m128i color_mask = _mm_set1_epi32(0x00FFFFFF);
+        __m128i alpha_bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(alpha));
+        __m128i alpha_lo = _mm_unpacklo_epi8(zero, alpha_bytes);
+        __m128i alpha_hi = _mm_unpackhi_epi8(zero, alpha_bytes);
+        __m128i alpha_rows[4] = {
+            _mm_unpacklo_epi16(zero, alpha_lo), _mm_unpackhi_epi16(zero, alpha_lo),
+            _mm_unpacklo_epi16(zero, alpha_hi), _mm_unpackhi_epi16(zero, alpha_hi)
+        };
+        for (size_t row = 0; row < 4; row++) {
+            rows[row] = _mm_or_si128(_mm_and_si128(rows[row], color_mask), alpha_rows[row]);
+        }
+    }
+
+    for (size_t row = 0; row < 4; row++) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + row * 16), rows[row]);
+    }
+}
+
+// Looks up 8 pixels at once with a cross lane permute
+TARGET_AVX2
+static void decode_block_avx2(DXTFormat fmt, const uint8_t* block, uint8_t* pixels)
+{
+    const uint8_t* color_block = (fmt == DXTFormat::DXT1) ? block : block + 8;
+    uint32_t palette[4];
+    build_color_palette(color_block, fmt == DXTFormat::DXT1,
+        reinterpret_cast<uint8_t(*)[4]>(palette));
+
+    const __m256i color_palette = _mm256_setr_epi32(
+        static_cast<int>(palette[0]), static_cast<int>(palette[1]),
+        static_cast<int>(palette[2]), static_cast<int>(palette[3]),
+        static_cast<int>(palette[0]), static_cast<int>(palette[1]),
+        static_cast<int>(palette[2]), static_cast<int>(palette[3]));
+    const __m256i shifts2 = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+    const __m256i mask2 = _mm256_set1_epi32(0x3);
+
+    uint32_t indices = load_le32(color_block + 4);
+    __m256i idx_lo = _mm256_and_si256(_mm256_srlv_epi32(
+        _mm256_set1_epi32(static_cast<int>(indices & 0xFFFF)), shifts2), mask2);
+    __m256i idx_hi = _mm256_and_si256(_mm256_srlv_epi32(
+        _mm256_set1_epi32(static_cast<int>(indices >> 16)), shifts2), mask2);
+    __m256i result_lo = _mm256_permutevar8x32_epi32(color_palette, idx_lo);
+    __m256i result_hi = _mm256_permutevar8x32_epi32(color_palette, idx_hi);
+
+    if (fmt != DXTFormat::DXT1) {
+        __m256i alpha_lo;
+        __m256i alpha_hi;
+        if (fmt == DXTFormat::DXT3) {
+            const __m256i shifts4 = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+            const __m256i mask4 = _mm256_set1_epi32(0xF);
+            alpha_lo = _mm256_and_si256(_mm256_srlv_epi32(
+                _mm256_set1_epi32(static_cast<int>(load_le32(block))), shifts4), mask4);
+            alpha_hi = _mm256_and_si256(_mm256_srlv_epi32(
+                _mm256_set1_epi32(static_cast<int>(load_le32(block + 4))), shifts4), mask4);
+            // 4 to 8 bits, then into the alpha byte
+            alpha_lo = _mm256_slli_epi32(_mm256_or_si256(alpha_lo, _mm256_slli_epi32(alpha_lo, 4)), 24);
+            alpha_hi = _mm256_slli_epi32(_mm256_or_si256(alpha_hi, _mm256_slli_epi32(alpha_hi, 4)), 24);
+        } else {
+            uint8_t alpha_palette[8];
+            build_alpha_palette(block, alpha_palette);
+            uint32_t alpha_shifted[8];
+            for (size_t i = 0; i < 8; i++) {
+                alpha_shifted[i] = static_cast<uint32_t>(alpha_palette[i]) << 24;
+            }
+            const __m256i alpha_table = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(alpha_shifted));
+            const __m256i shifts3 = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+            const __m256i mask3 = _mm256_set1_epi32(0x7);
+            uint32_t bits_lo = block[2] | (block[3] << 8) | (block[4] << 16);
+            uint32_t bits_hi = block[5] | (block[6] << 8) | (block[7] << 16);
+            alpha_lo = _mm256_permutevar8x32_epi32(alpha_table, _mm256_and_si256(
+                _mm256_srlv_epi32(_mm256_set1_epi32(static_cast<int>(bits_lo)), shifts3), mask3));
+            alpha_hi = _mm256_permutevar8x32_epi32(alpha_table, _mm256_and_si256(
+                _mm256_srlv_epi32(_mm256_set1_epi32(static_cast<int>(bits_hi)), shifts3), mask3));
+        }
+        const __m256i color_mask = _mm256_set1_epi32(0x00FFFFFF);
+        result_lo = _mm256_or_si256(_mm256_and_si256(result_lo, color_mask), alpha_lo);
+        result_hi = _mm256_or_si256(_mm256_and_si256(result_hi, color_mask), alpha_hi);
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels), result_lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + 32), result_hi);
+}
+
+#endif
+
+struct DecoderImpl
+{
+    DecodeBlockFunc func;
+    const char* name;
+};
+
+static DecoderImpl select_decoder()
+{
+#ifdef X86_SIMD
+    if (cpu_has_avx2()) {
+        return {decode_block_avx2, "avx2"};
+    }
+    if (cpu_has_sse2()) {
+        return {decode_block_sse2, "sse2"};
+    }
+#endif
+    return {decode_block_scalar, "scalar"};
+}
+
+static const DecoderImpl& get_decoder()
+{
+    static const DecoderImpl decoder = select_decoder();
+    return decoder;
+}
+
+const char* get_dxt_decoder_name()
+{
+    return get_decoder().name;
+}
+
+void decode_dxt_level(DXTFormat fmt, const uint8_t* blocks,
+    uint32_t width, uint32_t height, uint8_t* rgba)
+{
+    DecodeBlockFunc decode_block = get_decoder().func;
+    size_t block_size = get_block_size(fmt);
+    uint32_t width_blocks = std::max(1u, (width + 3) / 4);
+    uint32_t height_blocks = std::max(1u, (height + 3) / 4);
+    size_t row_bytes = static_cast<size_t>(width) * 4;
+
+    uint8_t pixels[BLOCK_PIXELS * 4];
+    for (uint32_t block_y = 0; block_y < height_blocks; block_y++) {
+        uint32_t rows = std::min(4u, height - std::min(height, block_y * 4));
+        for (uint32_t block_x = 0; block_x < width_blocks; block_x++) {
+            decode_block(fmt, blocks, pixels);
+            blocks += block_size;
+
+            // Blocks on the right and bottom edge can be partially outside
+            uint32_t cols = std::min(4u, width - std::min(width, block_x * 4));
+            uint8_t* dest = rgba + block_y * 4 * row_bytes + block_x * 16;
+            for (uint32_t row = 0; row < rows; row++) {
+                memcpy(dest + row * row_bytes, pixels + row * 16, cols * 4);
+            }
+        }
+    }
+}
+
+
+
+// Encoder
+
+// Rounding order matches fit_indices_sse2, so both give the same result
+static float fit_indices_scalar(const BlockColors& colors, const float palette[4][3],
+    uint8_t indices[16])
+{
+    float sums[4] = {};
+    for (size_t i = 0; i < 16; i++) {
+        float best = FLT_MAX;
+        uint8_t best_index = 0;
+        for (uint8_t pal_i = 0; pal_i < 4; pal_i++) {
+            float dr = colors.r[i] - palette[pal_i][0];
+            float dg = colors.g[i] - palette[pal_i][1];
+            float db = colors.b[i] - palette[pal_i][2];
+            float dist = (dr * dr + dg * dg) + db * db;
+            if (dist < best) {
+                best = dist;
+                best_index = pal_i;
+            }
+        }
+        indices[i] = best_index;
+        sums[i % 4] += best * colors.weight[i];
+    }
+    return (sums[0] + sums[2]) + (sums[1] + sums[3]);
+}
+
+#ifdef X86_SIMD
+
+TARGET_SSE2
+static float fit_indices_sse2(const BlockColors& colors, const float palette[4][3],
+    uint8_t indices[16])
+{
+    __m128 total = _mm_setzero_ps();
+    for (size_t pos = 0; pos < 16; pos += 4) {
+        __m128 r = _mm_load_ps(colors.r + pos);
+        __m128 g = _mm_load_ps(colors.g + pos);
+        __m128 b = _mm_load_ps(colors.b + pos);
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i best_index = _mm_setzero_si128();
+
+        for (int pal_i = 0; pal_i < 4; pal_i++) {
+            __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[pal_i][0]));
+            __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[pal_i][1]));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[pal_i][2]));
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+                _mm_mul_ps(db, db));
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(dist, best));
+            best = _mm_min_ps(dist, best);
+            best_index = _mm_or_si128(_mm_andnot_si128(closer, best_index),
+                _mm_and_si128(closer, _mm_set1_epi32(pal_i)));
+        }
+
+        total = _mm_add_ps(total, _mm_mul_ps(best, _mm_load_ps(colors.weight + pos)));
+        alignas(16) int32_t lane_indices[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lane_indices), best_index);
+        for (size_t lane = 0; lane < 4; lane++) {
+            indices[pos + lane] = static_cast<uint8_t>(lane_indices[lane]);
+        }
+    }
+
+    // (0 + 2) + (1 + 3), same as the scalar version
+    total = _mm_add_ps(total, _mm_movehl_ps(total, total));
+    total = _mm_add_ss(total, _mm_shuffle_ps(total, total, 1));
+    return _mm_cvtss_f32(total);
+}
+
+#endif
+
+struct EncoderImpl
+{
+    FitIndicesFunc fit;
+    const char* name;
+};
+
+static EncoderImpl select_encoder()
+{
+#ifdef X86_SIMD
+    if (cpu_has_sse2()) {
+        return {fit_indices_sse2, "sse2"};
+    }
+#endif
+    return {fit_indices_scalar, "scalar"};
+}
+
+static const EncoderImpl& get_encoder()
+{
+    static const EncoderImpl encoder = select_encoder();
+    return encoder;
+}
+
+const char* get_dxt_encoder_name()
+{
+    return get_encoder().name;
+}
+
+// Endpoints and indices of a color block before they are put in order
+struct ColorFit
+{
+    uint16_t color0 = 0;
+    uint16_t color1 = 0;
+    bool three_color = false; // DXT1 mode with transparent black as index 3
+    uint8_t indices[16] = {};
+    float error = FLT_MAX;
+};
+
+static uint16_t quantize_565(const float rgb[3])
+{
+    int r = static_cast<int>(rgb[0] * (31.0f / 255.0f) + 0.5f);
+    int g = static_cast<int>(rgb[1] * (63.0f / 255.0f) + 0.5f);
+    int b = static_cast<int>(rgb[2] * (31.0f / 255.0f) + 0.5f);
+    r = std::min(std::max(r, 0), 31);
+    g = std::min(std::max(g, 0), 63);
+    b = std::min(std::max(b, 0), 31);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+// Same palette as the decoder, for either order of the endpoints
+static void evaluate_fit(const BlockColors& colors, ColorFit& fit)
+{
+    uint32_t c0[3];
+    uint32_t c1[3];
+    expand_565(fit.color0, c0);
+    expand_565(fit.color1, c1);
+
+    float palette[4][3];
+    for (int ch = 0; ch < 3; ch++) {
+        palette[0][ch] = static_cast<float>(c0[ch]);
+        palette[1][ch] = static_cast<float>(c1[ch]);
+        if (fit.three_color) {
+            palette[2][ch] = static_cast<float>((c0[ch] + c1[ch]) / 2);
+            palette[3][ch] = 1.0e6f; // Never the closest color
+        } else {
+            palette[2][ch] = static_cast<float>((2 * c0[ch] + c1[ch]) / 3);
+            palette[3][ch] = static_cast<float>((c0[ch] + 2 * c1[ch]) / 3);
+        }
+    }
+
+    fit.error = get_encoder().fit(colors, palette, fit.indices);
+    if (fit.three_color) {
+        for (size_t i = 0; i < 16; i++) {
+            if (colors.weight[i] == 0.0f) {
+                fit.indices[i] = 3;
+            }
+        }
+    }
+}
+
+static void bounding_box_endpoints(const BlockColors& colors, float start[3], float end[3])
+{
+    float min_rgb[3] = {255.0f, 255.0f, 255.0f};
+    float max_rgb[3] = {0.0f, 0.0f, 0.0f};
+    for (size_t i = 0; i < 16; i++) {
+        if (colors.weight[i] == 0.0f) {
+            continue;
+        }
+        float rgb[3] = {colors.r[i], colors.g[i], colors.b[i]};
+        for (int ch = 0; ch < 3; ch++) {
+            min_rgb[ch] = std::min(min_rgb[ch], rgb[ch]);
+            max_rgb[ch] = std::max(max_rgb[ch], rgb[ch]);
+        }
+    }
+
+    // Move the endpoints inwards a bit, the extremes are rarely hit exactly
+    for (int ch = 0; ch < 3; ch++) {
+        float inset = (max_rgb[ch] - min_rgb[ch]) / 16.0f;
+        start[ch] = max_rgb[ch] - inset;
+        end[ch] = min_rgb[ch] + inset;
+    }
+}
+
+// Extremes along the axis with the largest variance of the colors
+static void principal_axis_endpoints(const BlockColors& colors, float start[3], float end[3])
+{
+    float count = 0.0f;
+    float mean[3] = {};
+    for (size_t i = 0; i < 16; i++) {
+        count += colors.weight[i];
+        mean[0] += colors.r[i] * colors.weight[i];
+        mean[1] += colors.g[i] * colors.weight[i];
+        mean[2] += colors.b[i] * colors.weight[i];
+    }
+    for (int ch = 0; ch < 3; ch++) {
+        mean[ch] /= count;
+    }
+
+    // Covariance matrix: rr, rg, rb, gg, gb, bb
+    float cov[6] = {};
+    for (size_t i = 0; i < 16; i++) {
+        float dr = (colors.r[i] - mean[0]) * colors.weight[i];
+        float dg = (colors.g[i] - mean[1]) * colors.weight[i];
+        float db = (colors.b[i] - mean[2]) * colors.weight[i];
+        cov[0] += dr * dr;
+        cov[1] += dr * dg;
+        cov[2] += dr * db;
+        cov[3] += dg * dg;
+        cov[4] += dg * db;
+        cov[5] += db * db;
+    }
+
+    // Power iteration
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+        };
+        float length = std::max(fabsf(next[0]), std::max(fabsf(next[1]), fabsf(next[2])));
+        if (length < 1.0e-6f) {
+            break;
+        }
+        for (int ch = 0; ch < 3; ch++) {
+            axis[ch] = next[ch] / length;
+        }
+    }
+    float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    for (int ch = 0; ch < 3; ch++) {
+        axis[ch] /= length;
+    }
+
+    float min_t = FLT_MAX;
+    float max_t = -FLT_MAX;
+    for (size_t i = 0; i < 16; i++) {
+        if (colors.weight[i] == 0.0f) {
+            continue;
+        }
+        float t = (colors.r[i] - mean[0]) * axis[0] + (colors.g[i] - mean[1]) * axis[1] +
+            (colors.b[i] - mean[2]) * axis[2];
+        min_t = std::min(min_t, t);
+        max_t = std::max(max_t, t);
+    }
+    for (int ch = 0; ch < 3; ch++) {
+        start[ch] = mean[ch] + axis[ch] * max_t;
+        end[ch] = mean[ch] + axis[ch] * min_t;
+    }
+}
+
+// Least squares endpoints for the current indices. Returns false if the
+// indices don't determine both endpoints.
+static bool refine_endpoints(const BlockColors& colors, const ColorFit& fit,
+    float start[3], float end[3])
+{
+    static const float WEIGHTS_4[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    static const float WEIGHTS_3[4] = {1.0f, 0.0f, 0.5f, 0.0f};
+    const float* weights = fit.three_color ? WEIGHTS_3 : WEIGHTS_4;
+
+    float aa = 0.0f;
+    float ab = 0.0f;
+    float bb = 0.0f;
+    float ax[3] = {};
+    float bx[3] = {};
+    for (size_t i = 0; i < 16; i++) {
+        if (colors.weight[i] == 0.0f) {
+            continue;
+        }
+        float a = weights[fit.indices[i]];
+        float b = 1.0f - a;
+        float rgb[3] = {colors.r[i], colors.g[i], colors.b[i]};
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int ch = 0; ch < 3; ch++) {
+            ax[ch] += a * rgb[ch];
+            bx[ch] += b * rgb[ch];
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+    if (fabsf(det) < 1.0e-4f) {
+        return false;
+    }
+    for (int ch = 0; ch < 3; ch++) {
+        start[ch] = std::min(255.0f, std::max(0.0f, (bb * ax[ch] - ab * bx[ch]) / det));
+        end[ch] = std::min(255.0f, std::max(0.0f, (aa * bx[ch] - ab * ax[ch]) / det));
+    }
+    return true;
+}
+
+// Tries moving every endpoint channel by one step while that lowers the error
+static void local_search(const BlockColors& colors, ColorFit& best)
+{
+    static const uint16_t CHANNEL_STEPS[3] = {1 << 11, 1 << 5, 1};
+    static const uint16_t CHANNEL_MASKS[3] = {0xF800, 0x07E0, 0x001F};
+
+    for (int pass = 0; pass < 4; pass++) {
+        bool improved = false;
+        for (int endpoint = 0; endpoint < 2; endpoint++) {
+            for (int ch = 0; ch < 3; ch++) {
+                for (int direction = -1; direction <= 1; direction += 2) {
+                    ColorFit candidate = best;
+                    uint16_t& color = (endpoint == 0) ? candidate.color0 : candidate.color1;
+                    uint16_t channel = color & CHANNEL_MASKS[ch];
+                    if (direction < 0 && channel == 0) {
+                        continue;
+                    }
+                    if (direction > 0 && channel == CHANNEL_MASKS[ch]) {
+                        continue;
+                    }
+                    color = static_cast<uint16_t>(
+                        (direction > 0) ? color + CHANNEL_STEPS[ch] : color - CHANNEL_STEPS[ch]);
+
+                    evaluate_fit(colors, candidate);
+                    if (candidate.error < best.error) {
+                        best = candidate;
+                        improved = true;
+                    }
+                }
+            }
+        }
+        if (!improved) {
+            break;
+        }
+    }
+}
+
+static ColorFit fit_color_block(const BlockColors& colors, bool three_color,
+    EncodeQuality quality)
+{
+    float start[3];
+    float end[3];
+    if (quality == EncodeQuality::Fast) {
+        bounding_box_endpoints(colors, start, end);
+    } else {
+        principal_axis_endpoints(colors, start, end);
+    }
+
+    ColorFit best;
+    best.three_color = three_color;
+    best.color0 = quantize_565(start);
+    best.color1 = quantize_565(end);
+    evaluate_fit(colors, best);
+
+    if (quality == EncodeQuality::High) {
+        for (int iteration = 0; iteration < 2; iteration++) {
+            if (!refine_endpoints(colors, best, start, end)) {
+                break;
+            }
+            ColorFit candidate = best;
+            candidate.color0 = quantize_565(start);
+            candidate.color1 = quantize_565(end);
+            evaluate_fit(colors, candidate);
+            if (!(candidate.error < best.error)) {
+                break;
+            }
+            best = candidate;
+        }
+        local_search(colors, best);
+    }
+    return best;
+}
+
+// Puts the endpoints in the order that selects the fit's palette mode
+static void write_color_block(const ColorFit& fit, uint8_t* color_block)
+{
+    uint16_t color0 = fit.color0;
+    uint16_t color1 = fit.color1;
+    uint8_t indices[16];
+    memcpy(indices, fit.indices, sizeof(indices));
+
+    if (fit.three_color) {
+        if (color0 > color1) {
+            std::swap(color0, color1);
+            for (uint8_t& index : indices) {
+                if (index < 2) {
+                    index ^= 1;
+                }
+            }
+        }
+    } else {
+        if (color0 < color1) {
+            // Swaps index 0 with 1 and 2 with 3
+            std::swap(color0, color1);
+            for (uint8_t& index : indices) {
+                index ^= 1;
+            }
+        } else if (color0 == color1) {
+            // Every palette entry is the same color, but DXT1 would see a
+            // 3 color block
+            memset(indices, 0, sizeof(indices));
+        }
+    }
+
+    uint32_t index_bits = 0;
+    for (size_t i = 0; i < 16; i++) {
+        index_bits |= static_cast<uint32_t>(indices[i]) << (2 * i);
+    }
+    color_block[0] = static_cast<uint8_t>(color0);
+    color_block[1] = static_cast<uint8_t>(color0 >> 8);
+    color_block[2] = static_cast<uint8_t>(color1);
+    color_block[3] = static_cast<uint8_t>(color1 >> 8);
+    for (size_t byte_i = 0; byte_i < 4; byte_i++) {
+        color_block[4 + byte_i] = static_cast<uint8_t>(index_bits >> (8 * byte_i));
+    }
+}
+
+static void encode_color_block(const uint8_t* pixels, uint8_t* color_block, bool dxt1,
+    EncodeQuality quality)
+{
+    BlockColors colors;
+    size_t transparent_count = 0;
+    for (size_t i = 0; i < 16; i++) {
+        colors.r[i] = pixels[i * 4];
+        colors.g[i] = pixels[i * 4 + 1];
+        colors.b[i] = pixels[i * 4 + 2];
+        if (dxt1 && pixels[i * 4 + 3] < 128) {
+            colors.weight[i] = 0.0f;
+            transparent_count++;
+        } else {
+            colors.weight[i] = 1.0f;
+        }
+    }
+
+    if (transparent_count == 16) {
+        ColorFit fit;
+        fit.three_color = true;
+        memset(fit.indices, 3, sizeof(fit.indices));
+        write_color_block(fit, color_block);
+        return;
+    }
+
+    ColorFit fit = fit_color_block(colors, transparent_count > 0, quality);
+    if (dxt1 && transparent_count == 0 && quality == EncodeQuality::High) {
+        // The 3 color mode is sometimes closer, e.g. for two colors
+        ColorFit three = fit;
+        three.three_color = true;
+        evaluate_fit(colors, three);
+        if (three.error < fit.error) {
+            fit = three;
+        }
+    }
+    write_color_block(fit, color_block);
+}
+
+static uint32_t fit_alpha_indices(const uint8_t* pixels, uint8_t alpha0, uint8_t alpha1,
+    uint8_t indices[16])
+{
+    uint8_t endpoints[2] = {alpha0, alpha1};
+    uint8_t palette[8];
+    build_alpha_palette(endpoints, palette);
+
+    uint32_t error = 0;
+    for (size_t i = 0; i < 16; i++) {
+        int alpha = pixels[i * 4 + 3];
+        int best = 256;
+        for (uint8_t pal_i = 0; pal_i < 8; pal_i++) {
+            int dist = abs(alpha - palette[pal_i]);
+            if (dist < best) {
+                best = dist;
+                indices[i] = pal_i;
+            }
+        }
+        error += static_cast<uint32_t>(best * best);
+    }
+    return error;
+}
+
+static void encode_dxt5_alpha(const uint8_t* pixels, uint8_t* block, EncodeQuality quality)
+{
+    uint8_t min_alpha = 0xFF;
+    uint8_t max_alpha = 0;
+    // Range without 0 and 255, those are in the 6 value palette anyway
+    uint8_t min_inner = 0xFF;
+    uint8_t max_inner = 0;
+    for (size_t i = 0; i < 16; i++) {
+        uint8_t alpha = pixels[i * 4 + 3];
+        min_alpha = std::min(min_alpha, alpha);
+        max_alpha = std::max(max_alpha, alpha);
+        if (alpha != 0 && alpha != 0xFF) {
+            min_inner = std::min(min_inner, alpha);
+            max_inner = std::max(max_inner, alpha);
+        }
+    }
+
+    // alpha0 > alpha1 selects the 8 value palette
+    uint8_t alpha0 = max_alpha;
+    uint8_t alpha1 = min_alpha;
+    uint8_t indices[16];
+    uint32_t error = fit_alpha_indices(pixels, alpha0, alpha1, indices);
+
+    if (quality == EncodeQuality::High && min_inner <= max_inner && error > 0) {
+        uint8_t inner_indices[16];
+        uint32_t inner_error = fit_alpha_indices(pixels, min_inner, max_inner, inner_indices);
+        if (inner_error < error) {
+            alpha0 = min_inner;
+            alpha1 = max_inner;
+            memcpy(indices, inner_indices, sizeof(indices));
+        }
+    }
+
+    uint64_t index_bits = 0;
+    for (size_t i = 0; i < 16; i++) {
+        index_bits |= static_cast<uint64_t>(indices[i]) << (3 * i);
+    }
+    block[0] = alpha0;
+    block[1] = alpha1;
+    for (size_t byte_i = 0; byte_i < 6; byte_i++) {
+        block[2 + byte_i] = static_cast<uint8_t>(index_bits >> (8 * byte_i));
+    }
+}
+
+static void encode_dxt3_alpha(const uint8_t* pixels, uint8_t* block)
+{
+    memset(block, 0, 8);
+    for (size_t i = 0; i < 16; i++) {
+        uint32_t value = (pixels[i * 4 + 3] * 15u + 127) / 255;
+        block[i / 2] |= static_cast<uint8_t>(value << (4 * (i & 1)));
+    }
+}
+
+static void encode_block(DXTFormat fmt, const uint8_t* pixels, uint8_t* block,
+    EncodeQuality quality)
+{
+    if (fmt == DXTFormat::DXT1) {
+        encode_color_block(pixels, block, true, quality);
+        return;
+    }
+
+    if (fmt == DXTFormat::DXT3) {
+        encode_dxt3_alpha(pixels, block);
+    } else {
+        encode_dxt5_alpha(pixels, block, quality);
+    }
+    encode_color_block(pixels, block + 8, false, quality);
+}
+
+void encode_dxt_rows(DXTFormat fmt, const uint8_t* rgba, uint32_t width, uint32_t height,
+    uint32_t first_row, uint32_t row_count, uint8_t* blocks, EncodeQuality quality)
+{
+    if (width == 0 || height == 0) {
+        return;
+    }
+
+    size_t block_size = get_block_size(fmt);
+    uint32_t width_blocks = (width + 3) / 4;
+    size_t row_bytes = static_cast<size_t>(width) * 4;
+
+    uint8_t pixels[BLOCK_PIXELS * 4];
+    for (uint32_t block_y = first_row; block_y < first_row + row_count; block_y++) {
+        for (uint32_t block_x = 0; block_x < width_blocks; block_x++) {
+            // Repeat the last row and column for blocks on the edge
+            for (uint32_t y = 0; y < 4; y++) {
+                uint32_t src_y = std::min(block_y * 4 + y, height - 1);
+                for (uint32_t x = 0; x < 4; x++) {
+                    uint32_t src_x = std::min(block_x * 4 + x, width - 1);
+                    memcpy(pixels + (y * 4 + x) * 4, rgba + src_y * row_bytes + src_x * 4, 4);
+                }
+            }
+
+            uint8_t* block = blocks + (static_cast<size_t>(block_y) * width_blocks + block_x) * block_size;
+            encode_block(fmt, pixels, block, quality);
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Block compression (S3TC) codecs. A block covers 4x4 pixels, pixels are
+// RGBA8 in row order with the bytes ordered R, G, B, A.
+// Documentation of the formats:
+// https://msdn.microsoft.com/en-us/library/windows/desktop/bb694531.aspx
+
+const size_t DXT1_BLOCK_SIZE = 8;
+const size_t DXT3_BLOCK_SIZE = 16;
+const size_t DXT5_BLOCK_SIZE = 16;
+const size_t BLOCK_PIXELS = 16;
+
+enum class DXTFormat
+{
+    DXT1,
+    DXT3,
+    DXT5
+};
+
+size_t get_block_size(DXTFormat fmt);
+
+// Decodes width x height pixels from a level of blocks into rgba, which has
+// room for width * height * 4 bytes. Uses SSE2 or AVX2 if the CPU has them.
+void decode_dxt_level(DXTFormat fmt, const uint8_t* blocks,
+    uint32_t width, uint32_t height, uint8_t* rgba);
+
+// Name of the decoder implementation picked for this CPU
+const char* get_dxt_decoder_name();
+
+enum class EncodeQuality
+{
+    Fast, // Bounding box of the block colors
+    Normal, // Principal axis of the block colors
+    High // Principal axis, refined with least squares and a local search
+};
+
+// Encodes the block rows [first_row, first_row + row_count) of a width x
+// height RGBA image. blocks points to the start of the level, so separate
+// row ranges can be encoded on separate threads.
+void encode_dxt_rows(DXTFormat fmt, const uint8_t* rgba, uint32_t width, uint32_t height,
+    uint32_t first_row, uint32_t row_count, uint8_t* blocks, EncodeQuality quality);
+
+// Name of the encoder implementation picked for this CPU
+const char* get_dxt_encoder_name();
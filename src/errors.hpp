@@ -21,6 +21,22 @@ inline field_error::field_error(const std::string& field_name_, const std::strin
 
 
 
+// Operating system level I/O failure, the message contains the file name
+
+class io_error : public std::runtime_error
+{
+public:
+    explicit io_error(const std::string& message);
+};
+
+inline io_error::io_error(const std::string& message)
+    : std::runtime_error(message)
+{
+
+}
+
+
+
 // Used for terminating the program inside shared functions
 
 class exit_error : public std::exception
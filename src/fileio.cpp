@@ -0,0 +1,726 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <algorithm> // std::min
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h> // flock
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h> // strerror
+#include <stdio.h> // rename
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#endif
+
+#include "errors.hpp"
+#include "stats.hpp"
+#include "fileio.hpp"
+
+static std::string last_error_string()
+{
+#ifdef _WIN32
+    char buffer[256] = {};
+    DWORD length = FormatMessageA(
+        FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+        NULL, GetLastError(), 0, buffer, sizeof(buffer), NULL);
+    std::string message(buffer, length);
+    size_t last_valid = message.find_last_not_of("\r\n. ");
+    return message.substr(0, last_valid + 1);
+#else
+    return strerror(errno);
+#endif
+}
+
+
+
+MappedFile::MappedFile()
+{
+
+}
+
+MappedFile::MappedFile(const std::string& filename)
+{
+    open(filename);
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+void MappedFile::open(const std::string& filename)
+{
+    close();
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        std::string message = last_error_string();
+        CloseHandle(file);
+        throw io_error(filename + ": " + message);
+    }
+
+    // Empty files can't be mapped, but they are still valid
+    if (file_size.QuadPart == 0) {
+        CloseHandle(file);
+        m_open = true;
+        return;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        std::string message = last_error_string();
+        CloseHandle(file);
+        throw io_error(filename + ": " + message);
+    }
+
+    // The view keeps the mapping and the file alive on its own
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    std::string message = last_error_string();
+    CloseHandle(mapping);
+    CloseHandle(file);
+    if (view == NULL) {
+        throw io_error(filename + ": " + message);
+    }
+    add_counter(StatCounter::MapCalls, 1);
+    add_counter(StatCounter::BytesMapped, static_cast<uint64_t>(file_size.QuadPart));
+
+    m_data = static_cast<const char*>(view);
+    m_size = static_cast<size_t>(file_size.QuadPart);
+    m_open = true;
+}
+
+void MappedFile::close()
+{
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+void MappedFile::advise_sequential()
+{
+
+}
+
+void MappedFile::will_need(uint64_t, uint64_t)
+{
+
+}
+#else
+void MappedFile::open(const std::string& filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        std::string message = last_error_string();
+        ::close(fd);
+        throw io_error(filename + ": " + message);
+    }
+
+    // Empty files can't be mapped, but they are still valid
+    if (file_stat.st_size == 0) {
+        ::close(fd);
+        m_open = true;
+        return;
+    }
+
+    size_t map_size = static_cast<size_t>(file_stat.st_size);
+    void* view = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    std::string message = last_error_string();
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        throw io_error(filename + ": " + message);
+    }
+    add_counter(StatCounter::MapCalls, 1);
+    add_counter(StatCounter::BytesMapped, map_size);
+
+    m_data = static_cast<const char*>(view);
+    m_size = map_size;
+    m_open = true;
+}
+
+void MappedFile::close()
+{
+    if (m_data != nullptr) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+void MappedFile::advise_sequential()
+{
+    if (m_data != nullptr) {
+        madvise(const_cast<char*>(m_data), m_size, MADV_SEQUENTIAL);
+    }
+}
+
+void MappedFile::will_need(uint64_t offset, uint64_t size)
+{
+    if (m_data == nullptr || offset >= m_size) {
+        return;
+    }
+    uint64_t page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t start = offset / page_size * page_size;
+    uint64_t end = std::min<uint64_t>(offset + size, m_size);
+    madvise(const_cast<char*>(m_data) + start, static_cast<size_t>(end - start), MADV_WILLNEED);
+}
+#endif
+
+bool MappedFile::is_open() const
+{
+    return m_open;
+}
+
+const char* MappedFile::data() const
+{
+    return m_data;
+}
+
+size_t MappedFile::size() const
+{
+    return m_size;
+}
+
+
+
+static const intptr_t INVALID_HANDLE = -1;
+static const size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+RawFile::RawFile() :
+    m_handle(INVALID_HANDLE)
+{
+
+}
+
+RawFile::~RawFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+static HANDLE to_handle(intptr_t handle)
+{
+    return reinterpret_cast<HANDLE>(handle);
+}
+
+void RawFile::open_read(const std::string& filename)
+{
+    close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+    m_handle = reinterpret_cast<intptr_t>(file);
+    m_filename = filename;
+    m_position = 0;
+}
+
+void RawFile::open_write(const std::string& filename)
+{
+    close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0,
+        NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+    m_handle = reinterpret_cast<intptr_t>(file);
+    m_filename = filename;
+    m_position = 0;
+}
+
+void RawFile::close()
+{
+    if (m_handle != INVALID_HANDLE) {
+        CloseHandle(to_handle(m_handle));
+    }
+    m_handle = INVALID_HANDLE;
+}
+
+// Unbuffered handles can't be switched after opening
+bool RawFile::set_direct(bool enabled)
+{
+    return !enabled;
+}
+
+void RawFile::advise_sequential()
+{
+
+}
+
+void RawFile::will_need(uint64_t, uint64_t)
+{
+
+}
+
+uint64_t RawFile::size() const
+{
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(to_handle(m_handle), &file_size)) {
+        throw io_error(m_filename + ": " + last_error_string());
+    }
+    return static_cast<uint64_t>(file_size.QuadPart);
+}
+
+void RawFile::read_at(uint64_t offset, char* buffer, size_t n)
+{
+    while (n > 0) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(n, 0x40000000));
+        DWORD bytes_read = 0;
+        if (!ReadFile(to_handle(m_handle), buffer, chunk, &bytes_read, &overlapped)) {
+            if (GetLastError() != ERROR_HANDLE_EOF) {
+                throw io_error(m_filename + ": " + last_error_string());
+            }
+        }
+        add_counter(StatCounter::ReadCalls, 1);
+        add_counter(StatCounter::BytesRead, bytes_read);
+        if (bytes_read == 0) {
+            throw io_error(m_filename + ": Unexpected end of file");
+        }
+        offset += bytes_read;
+        buffer += bytes_read;
+        n -= bytes_read;
+    }
+}
+
+void RawFile::write(const char* buffer, size_t n)
+{
+    while (n > 0) {
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(n, 0x40000000));
+        DWORD bytes_written = 0;
+        if (!WriteFile(to_handle(m_handle), buffer, chunk, &bytes_written, NULL)) {
+            throw io_error(m_filename + ": " + last_error_string());
+        }
+        add_counter(StatCounter::WriteCalls, 1);
+        add_counter(StatCounter::BytesWritten, bytes_written);
+        m_position += bytes_written;
+        buffer += bytes_written;
+        n -= bytes_written;
+    }
+}
+#else
+void RawFile::open_read(const std::string& filename)
+{
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+    m_handle = fd;
+    m_filename = filename;
+    m_position = 0;
+}
+
+void RawFile::open_write(const std::string& filename)
+{
+    close();
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+    m_handle = fd;
+    m_filename = filename;
+    m_position = 0;
+}
+
+void RawFile::close()
+{
+    if (m_handle != INVALID_HANDLE) {
+        ::close(static_cast<int>(m_handle));
+    }
+    m_handle = INVALID_HANDLE;
+}
+
+bool RawFile::set_direct(bool enabled)
+{
+    int fd = static_cast<int>(m_handle);
+#if defined(__linux__) && defined(O_DIRECT)
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) {
+        return false;
+    }
+    flags = enabled ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    return fcntl(fd, F_SETFL, flags) == 0;
+#elif defined(__APPLE__)
+    return fcntl(fd, F_NOCACHE, enabled ? 1 : 0) != -1;
+#else
+    (void)fd;
+    return !enabled;
+#endif
+}
+
+void RawFile::advise_sequential()
+{
+    int fd = static_cast<int>(m_handle);
+#ifdef __APPLE__
+    fcntl(fd, F_RDAHEAD, 1);
+#else
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+void RawFile::will_need(uint64_t offset, uint64_t size)
+{
+    int fd = static_cast<int>(m_handle);
+#ifdef __APPLE__
+    struct radvisory advice;
+    advice.ra_offset = static_cast<off_t>(offset);
+    advice.ra_count = static_cast<int>(std::min<uint64_t>(size, INT32_MAX));
+    fcntl(fd, F_RDADVISE, &advice);
+#else
+    posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(size), POSIX_FADV_WILLNEED);
+#endif
+}
+
+uint64_t RawFile::size() const
+{
+    struct stat file_stat;
+    if (fstat(static_cast<int>(m_handle), &file_stat) != 0) {
+        throw io_error(m_filename + ": " + last_error_string());
+    }
+    return static_cast<uint64_t>(file_stat.st_size);
+}
+
+void RawFile::read_at(uint64_t offset, char* buffer, size_t n)
+{
+    while (n > 0) {
+        ssize_t bytes_read = pread(static_cast<int>(m_handle), buffer, n,
+            static_cast<off_t>(offset));
+        add_counter(StatCounter::ReadCalls, 1);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw io_error(m_filename + ": " + last_error_string());
+        }
+        if (bytes_read == 0) {
+            throw io_error(m_filename + ": Unexpected end of file");
+        }
+        add_counter(StatCounter::BytesRead, static_cast<uint64_t>(bytes_read));
+        offset += bytes_read;
+        buffer += bytes_read;
+        n -= bytes_read;
+    }
+}
+
+void RawFile::write(const char* buffer, size_t n)
+{
+    while (n > 0) {
+        ssize_t bytes_written = ::write(static_cast<int>(m_handle), buffer, n);
+        add_counter(StatCounter::WriteCalls, 1);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw io_error(m_filename + ": " + last_error_string());
+        }
+        add_counter(StatCounter::BytesWritten, static_cast<uint64_t>(bytes_written));
+        m_position += bytes_written;
+        buffer += bytes_written;
+        n -= bytes_written;
+    }
+}
+#endif
+
+bool RawFile::is_open() const
+{
+    return m_handle != INVALID_HANDLE;
+}
+
+const std::string& RawFile::filename() const
+{
+    return m_filename;
+}
+
+uint64_t RawFile::tell() const
+{
+    return m_position;
+}
+
+void RawFile::write_zeros(size_t n)
+{
+    static const char zeros[4096] = {};
+    while (n > 0) {
+        size_t chunk = std::min(n, sizeof(zeros));
+        write(zeros, chunk);
+        n -= chunk;
+    }
+}
+
+#ifdef __linux__
+// Returns how many bytes the kernel managed to copy. Anything left over has
+// to be copied through userspace, which also reports the actual error.
+static uint64_t kernel_copy(int src_fd, uint64_t src_offset, int dst_fd, uint64_t size)
+{
+    uint64_t copied = 0;
+
+#ifdef SYS_copy_file_range
+    // Can share extents on filesystems with reflink support
+    loff_t in_offset = static_cast<loff_t>(src_offset);
+    while (copied < size) {
+        ssize_t result = syscall(SYS_copy_file_range, src_fd, &in_offset,
+            dst_fd, NULL, static_cast<size_t>(size - copied), 0u);
+        add_counter(StatCounter::CopyCalls, 1);
+        if (result > 0) {
+            copied += result;
+        } else if (result < 0 && errno == EINTR) {
+            continue;
+        } else {
+            break;
+        }
+    }
+#endif
+
+    off_t sendfile_offset = static_cast<off_t>(src_offset + copied);
+    while (copied < size) {
+        ssize_t result = sendfile(dst_fd, src_fd, &sendfile_offset,
+            static_cast<size_t>(size - copied));
+        add_counter(StatCounter::CopyCalls, 1);
+        if (result > 0) {
+            copied += result;
+        } else if (result < 0 && errno == EINTR) {
+            continue;
+        } else {
+            break;
+        }
+    }
+
+    return copied;
+}
+#endif
+
+void copy_range(RawFile& src, uint64_t src_offset, RawFile& dst, uint64_t size)
+{
+    uint64_t copied = 0;
+
+#ifdef __linux__
+    copied = kernel_copy(static_cast<int>(src.m_handle), src_offset,
+        static_cast<int>(dst.m_handle), size);
+    dst.m_position += copied;
+    add_counter(StatCounter::BytesRead, copied);
+    add_counter(StatCounter::BytesWritten, copied);
+#endif
+
+    if (copied == size) {
+        return;
+    }
+
+    std::vector<char> buffer(static_cast<size_t>(
+        std::min<uint64_t>(size - copied, COPY_BUFFER_SIZE)));
+    while (copied < size) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(size - copied, buffer.size()));
+        src.read_at(src_offset + copied, buffer.data(), chunk);
+        dst.write(buffer.data(), chunk);
+        copied += chunk;
+    }
+}
+
+#ifdef _WIN32
+void replace_file(const std::string& from, const std::string& to)
+{
+    if (!MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        throw io_error(to + ": " + last_error_string());
+    }
+}
+
+void sync_file(const std::string& filename)
+{
+    HANDLE handle = CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+    BOOL success = FlushFileBuffers(handle);
+    std::string error = success ? "" : last_error_string();
+    CloseHandle(handle);
+    if (!success) {
+        throw io_error(filename + ": " + error);
+    }
+}
+
+// MoveFileEx with MOVEFILE_WRITE_THROUGH already flushes the rename
+void sync_directory(const std::string&)
+{
+
+}
+#else
+void replace_file(const std::string& from, const std::string& to)
+{
+    if (rename(from.c_str(), to.c_str()) != 0) {
+        throw io_error(to + ": " + last_error_string());
+    }
+}
+
+static void sync_path(const std::string& filename, int flags)
+{
+    int fd = ::open(filename.c_str(), flags);
+    if (fd < 0) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+    int result = fsync(fd);
+    std::string error = (result != 0) ? last_error_string() : "";
+    ::close(fd);
+    if (result != 0) {
+        throw io_error(filename + ": " + error);
+    }
+}
+
+void sync_file(const std::string& filename)
+{
+    sync_path(filename, O_RDONLY);
+}
+
+void sync_directory(const std::string& dirname)
+{
+    sync_path(dirname.empty() ? "." : dirname, O_RDONLY | O_DIRECTORY);
+}
+#endif
+
+
+
+#ifdef _WIN32
+FileLock::FileLock(const std::string& filename)
+{
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+    OVERLAPPED overlapped = {};
+    if (!LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped)) {
+        std::string error = last_error_string();
+        CloseHandle(file);
+        throw io_error(filename + ": " + error);
+    }
+    m_handle = reinterpret_cast<intptr_t>(file);
+}
+
+// Closing the handle releases the lock
+FileLock::~FileLock()
+{
+    CloseHandle(to_handle(m_handle));
+}
+#else
+FileLock::FileLock(const std::string& filename)
+{
+    int fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        throw io_error(filename + ": " + last_error_string());
+    }
+    int result;
+    do {
+        result = flock(fd, LOCK_EX);
+    } while (result != 0 && errno == EINTR);
+    if (result != 0) {
+        std::string error = last_error_string();
+        ::close(fd);
+        throw io_error(filename + ": " + error);
+    }
+    m_handle = fd;
+}
+
+// Closing the descriptor releases the lock
+FileLock::~FileLock()
+{
+    ::close(static_cast<int>(m_handle));
+}
+#endif
+
+
+
+Prefetcher::Prefetcher(std::vector<Range> ranges, uint64_t window,
+    std::function<void(uint64_t, uint64_t)> advise) :
+    m_ranges(std::move(ranges)),
+    m_window(window),
+    m_advise(std::move(advise))
+{
+    m_thread = std::thread(&Prefetcher::run, this);
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_changed.notify_all();
+    m_thread.join();
+}
+
+void Prefetcher::advance(size_t range_index)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (range_index <= m_read_index) {
+            return;
+        }
+        m_read_index = range_index;
+    }
+    m_changed.notify_all();
+}
+
+void Prefetcher::run()
+{
+    // Advised bytes from the range being read up to range_i
+    size_t read_index = 0;
+    uint64_t ahead = 0;
+    for (size_t range_i = 0; range_i < m_ranges.size(); range_i++) {
+        const Range& range = m_ranges[range_i];
+        bool reached;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true) {
+                while (read_index < m_read_index && read_index < range_i) {
+                    ahead -= m_ranges[read_index].size;
+                    read_index++;
+                }
+                if (m_stopping) {
+                    return;
+                }
+                // The next range is always advised, even if it's bigger than
+                // the window
+                if (m_read_index >= range_i || ahead == 0 || ahead + range.size <= m_window) {
+                    break;
+                }
+                m_changed.wait(lock);
+            }
+            reached = (m_read_index >= range_i);
+        }
+        ahead += range.size;
+        if (!reached) {
+            m_advise(range.offset, range.size);
+        }
+    }
+}
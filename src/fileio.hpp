@@ -0,0 +1,145 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Read-only memory mapping of a whole file. Used to access texture data
+// without copying it into the heap first.
+
+class MappedFile
+{
+public:
+    MappedFile();
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void open(const std::string& filename);
+    void close();
+    bool is_open() const;
+    const char* data() const;
+    size_t size() const;
+
+    // Access pattern hints, they do nothing where they aren't supported
+    void advise_sequential();
+    void will_need(uint64_t offset, uint64_t size);
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_open = false;
+};
+
+
+const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+// Unbuffered file handle for moving large blocks of texture data. Errors are
+// thrown as io_error.
+
+class RawFile
+{
+public:
+    RawFile();
+    ~RawFile();
+    RawFile(const RawFile&) = delete;
+    RawFile& operator=(const RawFile&) = delete;
+
+    void open_read(const std::string& filename);
+    void open_write(const std::string& filename);
+    void close();
+    bool is_open() const;
+    const std::string& filename() const;
+    uint64_t size() const;
+    uint64_t tell() const;
+
+    // Access pattern hints for reading, they do nothing where they aren't
+    // supported
+    void advise_sequential();
+    void will_need(uint64_t offset, uint64_t size);
+
+    // Reads exactly n bytes at offset, failing on end of file
+    void read_at(uint64_t offset, char* buffer, size_t n);
+    // Writes n bytes at the current position
+    void write(const char* buffer, size_t n);
+    void write_zeros(size_t n);
+    // Bypasses the page cache for writes. Offsets, sizes and buffer addresses
+    // then have to be multiples of DIRECT_IO_ALIGNMENT. Returns false if the
+    // system or file system doesn't support it.
+    bool set_direct(bool enabled);
+
+    friend void copy_range(RawFile& src, uint64_t src_offset, RawFile& dst, uint64_t size);
+
+private:
+    intptr_t m_handle;
+    std::string m_filename;
+    uint64_t m_position = 0;
+};
+
+// Copies size bytes at src_offset in src to the current position of dst. Uses
+// the kernel to copy between the files where that is supported.
+void copy_range(RawFile& src, uint64_t src_offset, RawFile& dst, uint64_t size);
+
+// Moves a file over another one, replacing it
+void replace_file(const std::string& from, const std::string& to);
+
+// Flush a file or the entries of a directory to disk. Renames are only
+// durable once their directory is synced.
+void sync_file(const std::string& filename);
+void sync_directory(const std::string& dirname);
+
+// Exclusive advisory lock on a file, held until the object is destroyed.
+// Blocks while another process holds it. The file is created if it doesn't
+// exist and is left behind afterwards, removing it would let two processes
+// lock different files of the same name.
+class FileLock
+{
+public:
+    explicit FileLock(const std::string& filename);
+    ~FileLock();
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+private:
+    intptr_t m_handle;
+};
+
+// Calls advise on a background thread for the ranges ahead of the reader, up
+// to window bytes ahead. Used with will_need when the reads jump around so
+// the kernel's own readahead doesn't help. Ranges are passed in the order
+// they get read.
+class Prefetcher
+{
+public:
+    struct Range
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    Prefetcher(std::vector<Range> ranges, uint64_t window,
+        std::function<void(uint64_t, uint64_t)> advise);
+    ~Prefetcher();
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    // The reader started on this range
+    void advance(size_t range_index);
+
+private:
+    void run();
+
+    std::vector<Range> m_ranges;
+    uint64_t m_window;
+    std::function<void(uint64_t, uint64_t)> m_advise;
+    size_t m_read_index = 0;
+    bool m_stopping = false;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::thread m_thread;
+};
@@ -0,0 +1,211 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h> // memcpy
+
+#include "simd.hpp"
+#include "hash.hpp"
+
+const size_t LANE_COUNT = 8;
+const size_t STRIPE_SIZE = LANE_COUNT * 8;
+// The accumulators get scrambled after every block of stripes
+const size_t BLOCK_STRIPES = 16;
+
+const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+const uint32_t PRIME32_1 = 0x9E3779B1U;
+
+// Mixed into the data before multiplying. Stripe i of a block uses the keys
+// starting at index i, so reordering stripes changes the hash.
+static const uint64_t STRIPE_KEYS[BLOCK_STRIPES + LANE_COUNT - 1] = {
+    0xAE2F0C262EF97B9BULL, 0xD63FB0EE649859D2ULL, 0x8130AC7EF3D14864ULL, 0x45465FAF08FD1F53ULL,
+    0x9D05F4F11243EB7FULL, 0xE935D75701702EB6ULL, 0xC4ABCDF37A853FF9ULL, 0x4E67C9887C947837ULL,
+    0x5F41F2C808AA1D75ULL, 0x49973B3255FD96EFULL, 0x9E1C7D02834BE8D9ULL, 0xE0AFD3FC4210A304ULL,
+    0xDAD8C3F09DB7031AULL, 0x4F55A6634D52361FULL, 0xDDFF6B89EA02B467ULL, 0xA08C1FBF3432F4D1ULL,
+    0x436601783D296DC5ULL, 0x280708393703102DULL, 0xBDCC5F799B15AF8AULL, 0x0D1295070AE5D021ULL,
+    0x0281CAAFA1EE9F7FULL, 0xFA513204278B2BCFULL, 0x0E08CC3A37EE3E99ULL
+};
+
+// Mixed into the accumulators when they get scrambled
+static const uint64_t SCRAMBLE_KEYS[LANE_COUNT] = {
+    0xCB00C391BB52283CULL, 0xA32E531B8B65D088ULL, 0x4EF90DA297486471ULL, 0xD8ACDEA946EF1938ULL,
+    0x3F349CE33F76FAA8ULL, 0x1D4F0BC7C7BBDCF9ULL, 0x3159B4CD4BE0518AULL, 0x647378D9C97E9FC8ULL
+};
+
+typedef void (*AccumulateFunc)(uint64_t* acc, const uint8_t* data, size_t stripe_count,
+    const uint64_t* keys);
+
+static uint64_t load_u64(const uint8_t* data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint64_t rotl64(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Every lane adds the product of the low and high half of its keyed data,
+// plus the unkeyed data of its neighbour so no input bits get lost
+static void accumulate_scalar(uint64_t* acc, const uint8_t* data, size_t stripe_count,
+    const uint64_t* keys)
+{
+    for (size_t stripe_i = 0; stripe_i < stripe_count; stripe_i++) {
+        const uint8_t* stripe = data + stripe_i * STRIPE_SIZE;
+        for (size_t lane = 0; lane < LANE_COUNT; lane++) {
+            uint64_t value = load_u64(stripe + lane * 8);
+            uint64_t keyed = value ^ keys[stripe_i + lane];
+            acc[lane ^ 1] += value;
+            acc[lane] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+        }
+    }
+}
+
+#ifdef X86_SIMD
+
+TARGET_SSE2
+static void accumulate_sse2(uint64_t* acc, const uint8_t* data, size_t stripe_count,
+    const uint64_t* keys)
+{
+    __m128i acc_vec[4];
+    for (size_t i = 0; i < 4; i++) {
+        acc_vec[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc) + i);
+    }
+    for (size_t stripe_i = 0; stripe_i < stripe_count; stripe_i++) {
+        const __m128i* stripe = reinterpret_cast<const __m128i*>(data + stripe_i * STRIPE_SIZE);
+        const __m128i* stripe_keys = reinterpret_cast<const __m128i*>(keys + stripe_i);
+        for (size_t i = 0; i < 4; i++) {
+            __m128i value = _mm_loadu_si128(stripe + i);
+            __m128i keyed = _mm_xor_si128(value, _mm_loadu_si128(stripe_keys + i));
+            __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+            __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            acc_vec[i] = _mm_add_epi64(acc_vec[i], _mm_add_epi64(product, swapped));
+        }
+    }
+    for (size_t i = 0; i < 4; i++) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc) + i, acc_vec[i]);
+    }
+}
+
+TARGET_AVX2
+static void accumulate_avx2(uint64_t* acc, const uint8_t* data, size_t stripe_count,
+    const uint64_t* keys)
+{
+    __m256i acc_vec[2];
+    for (size_t i = 0; i < 2; i++) {
+        acc_vec[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc) + i);
+    }
+    for (size_t stripe_i = 0; stripe_i < stripe_count; stripe_i++) {
+        const __m256i* stripe = reinterpret_cast<const __m256i*>(data + stripe_i * STRIPE_SIZE);
+        const __m256i* stripe_keys = reinterpret_cast<const __m256i*>(keys + stripe_i);
+        for (size_t i = 0; i < 2; i++) {
+            __m256i value = _mm256_loadu_si256(stripe + i);
+            __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256(stripe_keys + i));
+            __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+            __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            acc_vec[i] = _mm256_add_epi64(acc_vec[i], _mm256_add_epi64(product, swapped));
+        }
+    }
+    for (size_t i = 0; i < 2; i++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc) + i, acc_vec[i]);
+    }
+}
+
+#endif
+
+struct HashFunctions
+{
+    AccumulateFunc accumulate;
+    const char* name;
+};
+
+static HashFunctions select_functions()
+{
+#ifdef X86_SIMD
+    if (cpu_has_avx2()) {
+        return {accumulate_avx2, "avx2"};
+    }
+    if (cpu_has_sse2()) {
+        return {accumulate_sse2, "sse2"};
+    }
+#endif
+    return {accumulate_scalar, "scalar"};
+}
+
+static const HashFunctions& get_functions()
+{
+    static const HashFunctions functions = select_functions();
+    return functions;
+}
+
+const char* get_hash_name()
+{
+    return get_functions().name;
+}
+
+// Spreads the high bits of the accumulators back into the low bits, which
+// the multiplications would otherwise ignore
+static void scramble(uint64_t* acc)
+{
+    for (size_t lane = 0; lane < LANE_COUNT; lane++) {
+        uint64_t value = acc[lane];
+        value ^= value >> 47;
+        value ^= SCRAMBLE_KEYS[lane];
+        acc[lane] = value * PRIME32_1;
+    }
+}
+
+static uint64_t avalanche(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t hash_data(const void* data, size_t size)
+{
+    AccumulateFunc accumulate = get_functions().accumulate;
+    const uint8_t* pos = static_cast<const uint8_t*>(data);
+    uint64_t acc[LANE_COUNT] = {
+        PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_1, PRIME64_2, PRIME64_5
+    };
+
+    // Whole blocks, then the remaining whole stripes
+
+    size_t block_size = BLOCK_STRIPES * STRIPE_SIZE;
+    size_t remaining = size;
+    for (; remaining >= block_size; remaining -= block_size) {
+        accumulate(acc, pos, BLOCK_STRIPES, STRIPE_KEYS);
+        scramble(acc);
+        pos += block_size;
+    }
+    size_t stripe_count = remaining / STRIPE_SIZE;
+    accumulate(acc, pos, stripe_count, STRIPE_KEYS);
+    pos += stripe_count * STRIPE_SIZE;
+    remaining -= stripe_count * STRIPE_SIZE;
+
+    // The last partial stripe is padded with zeros, the size is mixed in
+    // below so padding can't cause collisions
+
+    if (remaining > 0) {
+        uint8_t last_stripe[STRIPE_SIZE] = {};
+        memcpy(last_stripe, pos, remaining);
+        accumulate_scalar(acc, last_stripe, 1, STRIPE_KEYS + stripe_count);
+    }
+
+    // Merge the lanes
+
+    uint64_t hash = static_cast<uint64_t>(size) * PRIME64_1 + PRIME64_5;
+    for (size_t lane = 0; lane < LANE_COUNT; lane++) {
+        hash ^= rotl64(acc[lane] * PRIME64_2, 31) * PRIME64_1;
+        hash = rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+    return avalanche(hash);
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Fast non-cryptographic 64 bit hash for finding identical texture data.
+// Data is consumed in 64 byte stripes by 8 independent lanes, which map onto
+// SSE2 and AVX2 registers. All implementations give the same result.
+
+uint64_t hash_data(const void* data, size_t size);
+
+// Name of the implementation picked for this CPU
+const char* get_hash_name();
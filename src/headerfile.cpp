@@ -4,9 +4,11 @@
 #include <utility> // std::move
 #include <algorithm> // std::max
 #include <cassert>
+#include <stdexcept> // std::runtime_error
+#include <string.h> // memchr, memcpy
 
 #include "ddsfile.hpp"
-#include "byteio.hpp"
+#include "binlayout.hpp"
 #include "errors.hpp"
 #include "headerfile.hpp"
 
@@ -70,67 +72,161 @@ std::string get_entry_flag_names(uint16_t flags)
     return names;
 }
 
-uint32_t calc_compressed_size(uint32_t width, uint32_t height, uint32_t blocksize)
+uint64_t calc_compressed_size(uint32_t width, uint32_t height, uint32_t blocksize)
 {
-    uint32_t width_blocks = std::max(1u, (width + 3) / 4);
-    uint32_t height_blocks = std::max(1u, (height + 3) / 4);
+    uint64_t width_blocks = std::max(1u, (width + 3) / 4);
+    uint64_t height_blocks = std::max(1u, (height + 3) / 4);
 
     return width_blocks * height_blocks * blocksize;
 }
 
+// Size of a single mip level, 0 for unknown formats
+uint64_t calc_level_size(TextureFormat fmt, uint32_t width, uint32_t height)
+{
+    switch (fmt) {
+    case TextureFormat::PC_DXT1:
+        return calc_compressed_size(width, height, 8);
+    case TextureFormat::PC_DXT3:
+    case TextureFormat::PC_DXT5:
+        return calc_compressed_size(width, height, 16);
+    case TextureFormat::PC_UNKNOWN:
+        return 0;
+    default:
+        break;
+    }
+
+    try {
+        uint64_t bit_count = get_pixelformat(fmt).rgb_bit_count;
+        return (width * bit_count + 7) / 8 * height;
+    } catch (const field_error&) {
+        return 0;
+    }
+}
+
+
+
+typedef Layout<PegHeader,
+    LAYOUT_FIELD(PegHeader, signature),
+    LAYOUT_FIELD(PegHeader, version),
+    LAYOUT_FIELD(PegHeader, platform),
+    LAYOUT_FIELD(PegHeader, dir_block_size),
+    LAYOUT_FIELD(PegHeader, data_block_size),
+    LAYOUT_FIELD(PegHeader, num_bitmaps),
+    LAYOUT_FIELD(PegHeader, flags),
+    LAYOUT_FIELD(PegHeader, total_entries),
+    LAYOUT_FIELD(PegHeader, alignment)
+> PegHeaderLayout;
+static_assert(PegHeaderLayout::size == PEGHEADER_BINSIZE, "PegHeader layout size mismatch");
+
+typedef Layout<PegEntry,
+    LAYOUT_FIELD(PegEntry, offset),
+    LAYOUT_FIELD(PegEntry, width),
+    LAYOUT_FIELD(PegEntry, height),
+    LAYOUT_FIELD_AS(PegEntry, bm_fmt, uint16_t),
+    LAYOUT_FIELD(PegEntry, pal_fmt),
+    LAYOUT_FIELD(PegEntry, anim_tiles_width),
+    LAYOUT_FIELD(PegEntry, anim_tiles_height),
+    LAYOUT_FIELD(PegEntry, num_frames),
+    LAYOUT_FIELD(PegEntry, flags),
+    LAYOUT_FIELD(PegEntry, filename_p),
+    LAYOUT_FIELD(PegEntry, pal_size),
+    LAYOUT_FIELD(PegEntry, fps),
+    LAYOUT_FIELD(PegEntry, mip_levels),
+    LAYOUT_FIELD(PegEntry, data_size),
+    LAYOUT_FIELD(PegEntry, next),
+    LAYOUT_FIELD(PegEntry, prev),
+    LAYOUT_ARRAY(PegEntry, cache),
+    LayoutPadding<8>
+> PegEntryLayout;
+static_assert(PegEntryLayout::size == PEGENTRY_BINSIZE, "PegEntry layout size mismatch");
+
+// Console headers are big endian, which shows in a swapped signature
+static ByteOrder detect_byte_order(const char* data)
+{
+    uint32_t signature = load_value<uint32_t>(data, ByteOrder::Little);
+    if (swap_bytes(signature) == FOURCC_GEKV) {
+        return ByteOrder::Big;
+    }
+    return ByteOrder::Little;
+}
+
 
 
 void PegHeader::read(std::istream& stream)
 {
-    ByteReader reader(stream);
+    // Read the whole header block at once, dir_block_size is at offset 8
+    std::vector<char> buffer(PEGHEADER_BINSIZE);
+    stream.read(buffer.data(), PEGHEADER_BINSIZE);
+    uint32_t block_size = load_value<uint32_t>(buffer.data() + 8, detect_byte_order(buffer.data()));
+    if (block_size > PEGHEADER_BINSIZE) {
+        buffer.resize(block_size);
+        stream.read(buffer.data() + PEGHEADER_BINSIZE, block_size - PEGHEADER_BINSIZE);
+    }
+    read(buffer.data(), buffer.size());
+}
 
-    signature = reader.readU32();
-    version = reader.readS16();
-    platform = reader.readS16();
-    dir_block_size = reader.readU32();
-    data_block_size = reader.readU32();
-    num_bitmaps = reader.readU16();
-    flags = reader.readU16();
-    total_entries = reader.readU16();
-    alignment = reader.readU16();
+// Checks the fixed size fields and finds the names in a header block
 
-    if (signature != FOURCC_GEKV) {
-        throw field_error("signature", std::string(reinterpret_cast<char*>(&signature), 4));
+static std::vector<StringView> parse_header(PegHeader& header, const char* data, size_t size)
+{
+    if (size < PEGHEADER_BINSIZE) {
+        throw std::runtime_error("Unexpected end of header");
     }
 
-    if (version != 13) {
-        throw field_error("version", std::to_string(version));
+    header.byte_order = detect_byte_order(data);
+    PegHeaderLayout::read(header, data, header.byte_order);
+
+    if (header.signature != FOURCC_GEKV) {
+        throw field_error("signature", std::string(reinterpret_cast<char*>(&header.signature), 4));
     }
 
-    if (num_bitmaps != total_entries) {
-        throw field_error("num_bitmaps", std::to_string(total_entries));
+    if (header.version != 13) {
+        throw field_error("version", std::to_string(header.version));
     }
 
-    for (size_t entry_i = 0; entry_i < total_entries; entry_i++) {
-        PegEntry entry;
-        entry.read(stream);
-        entries.push_back(std::move(entry));
+    if (header.num_bitmaps != header.total_entries) {
+        throw field_error("num_bitmaps", std::to_string(header.total_entries));
+    }
+
+    size_t names_offset = PEGHEADER_BINSIZE + PEGENTRY_BINSIZE * header.total_entries;
+    if (size < names_offset) {
+        throw std::runtime_error("Unexpected end of header");
     }
 
-    for (PegEntry& entry : entries) {
-        entry.filename = reader.readCString();
+    // The names follow the entries as a list of null terminated strings. The
+    // terminator of the last one may be missing.
+
+    std::vector<StringView> names(header.total_entries);
+    const char* name_pos = data + names_offset;
+    const char* data_end = data + size;
+    for (StringView& name : names) {
+        if (name_pos >= data_end) {
+            throw std::runtime_error("Unexpected end of header");
+        }
+        const void* terminator = memchr(name_pos, '\0', data_end - name_pos);
+        const char* name_end = terminator ? static_cast<const char*>(terminator) : data_end;
+        name = StringView(name_pos, name_end - name_pos);
+        name_pos = name_end + 1;
     }
+    return names;
 }
 
-void PegHeader::write(std::ostream& stream) const
+void PegHeader::read(const char* data, size_t size)
 {
-    ByteWriter writer(stream);
-
-    writer.writeU32(signature);
-    writer.writeS16(version);
-    writer.writeS16(platform);
-    writer.writeU32(dir_block_size);
-    writer.writeU32(data_block_size);
-    writer.writeU16(num_bitmaps);
-    writer.writeU16(flags);
-    writer.writeU16(total_entries);
-    writer.writeU16(alignment);
+    std::vector<StringView> names = parse_header(*this, data, size);
+
+    entries.clear();
+    entries.resize(total_entries);
+    for (size_t entry_i = 0; entry_i < total_entries; entry_i++) {
+        entries[entry_i].read(data + PEGHEADER_BINSIZE + PEGENTRY_BINSIZE * entry_i, byte_order);
+        entries[entry_i].filename = names[entry_i].str();
+    }
+
+    rebuild_index();
+}
 
+void PegHeader::write(std::ostream& stream) const
+{
     if (total_entries != entries.size()) {
         throw field_error("total_entries", std::to_string(total_entries));
     }
@@ -138,16 +234,27 @@ void PegHeader::write(std::ostream& stream) const
         throw field_error("num_bitmaps", std::to_string(num_bitmaps));
     }
 
+    // Build the whole block in memory and write it at once
+
+    std::vector<char> buffer(size());
+    PegHeaderLayout::write(*this, buffer.data(), byte_order);
+
+    char* entry_pos = buffer.data() + PEGHEADER_BINSIZE;
     for (const PegEntry& entry : entries) {
-        entry.write(stream);
+        entry.write(entry_pos, byte_order);
+        entry_pos += PEGENTRY_BINSIZE;
     }
 
+    char* name_pos = entry_pos;
     for (const PegEntry& entry : entries) {
         if (entry.filename.empty()) {
             throw field_error("filename", "empty");
         }
-        writer.writeCString(entry.filename);
+        memcpy(name_pos, entry.filename.c_str(), entry.filename.size() + 1);
+        name_pos += entry.filename.size() + 1;
     }
+
+    stream.write(buffer.data(), buffer.size());
 }
 
 size_t PegHeader::size() const
@@ -162,16 +269,16 @@ size_t PegHeader::size() const
 
 size_t PegHeader::entry_index(const std::string& name) const
 {
-    for (size_t entry_i = 0; entry_i < total_entries; entry_i++) {
-        if (entries[entry_i].filename == name) {
-            return entry_i;
-        }
+    auto found = entry_map.find(name);
+    if (found == entry_map.end()) {
+        return SIZE_MAX;
     }
-    return SIZE_MAX;
+    return found->second;
 }
 
 void PegHeader::add_entry(PegEntry entry)
 {
+    entry_map.emplace(entry.filename, entries.size());
     entries.push_back(std::move(entry));
     num_bitmaps++;
     total_entries++;
@@ -179,68 +286,87 @@ void PegHeader::add_entry(PegEntry entry)
 
 bool PegHeader::remove_entry(const std::string& name)
 {
-    for (auto iter = entries.begin(); iter < entries.end(); iter++) {
-        if (iter->filename == name) {
-            entries.erase(iter);
-            num_bitmaps--;
-            total_entries--;
-            return true;
+    size_t index = entry_index(name);
+    if (index == SIZE_MAX) {
+        return false;
+    }
+
+    entries.erase(entries.begin() + index);
+    num_bitmaps--;
+    total_entries--;
+    rebuild_index();
+    return true;
+}
+
+// Like remove_entry for every name, only the first entry with a name is
+// removed, but the index is only rebuilt once
+size_t PegHeader::remove_entries(const std::unordered_set<std::string>& names)
+{
+    std::vector<bool> remove(entries.size(), false);
+    for (const std::string& name : names) {
+        size_t index = entry_index(name);
+        if (index != SIZE_MAX) {
+            remove[index] = true;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t entry_i = 0; entry_i < entries.size(); entry_i++) {
+        if (!remove[entry_i]) {
+            if (kept != entry_i) {
+                entries[kept] = std::move(entries[entry_i]);
+            }
+            kept++;
         }
     }
+    size_t removed = entries.size() - kept;
+    entries.resize(kept);
 
-    return false;
+    num_bitmaps -= static_cast<uint16_t>(removed);
+    total_entries -= static_cast<uint16_t>(removed);
+    rebuild_index();
+    return removed;
+}
+
+void PegHeader::rename_entry(size_t index, const std::string& new_name)
+{
+    entries.at(index).filename = new_name;
+    rebuild_index();
+}
+
+void PegHeader::rebuild_index()
+{
+    entry_map.clear();
+    entry_map.reserve(entries.size());
+    for (size_t entry_i = 0; entry_i < entries.size(); entry_i++) {
+        entry_map.emplace(entries[entry_i].filename, entry_i);
+    }
 }
 
 
 
 void PegEntry::read(std::istream& stream)
 {
-    ByteReader reader(stream);
-
-    offset = reader.readS64();
-    width = reader.readU16();
-    height = reader.readU16();
-    bm_fmt = static_cast<TextureFormat>(reader.readU16());
-    pal_fmt = reader.readU16();
-    anim_tiles_width = reader.readU16();
-    anim_tiles_height = reader.readU16();
-    num_frames = reader.readU16();
-    flags = reader.readU16();
-    filename_p = reader.readS64();
-    pal_size = reader.readU16();
-    fps = reader.readU8();
-    mip_levels = reader.readU8();
-    data_size = reader.readU32();
-    next = reader.readU64();
-    prev = reader.readU64();
-    cache[0] = reader.readU32();
-    cache[1] = reader.readU32();
-    reader.readU64(); // padding
+    char buffer[PEGENTRY_BINSIZE];
+    stream.read(buffer, PEGENTRY_BINSIZE);
+    read(buffer, ByteOrder::Little);
+}
+
+void PegEntry::read(const char* data, ByteOrder order)
+{
+    PegEntryLayout::read(*this, data, order);
 }
 
 void PegEntry::write(std::ostream& stream) const
 {
-    ByteWriter writer(stream);
-
-    writer.writeS64(offset);
-    writer.writeU16(width);
-    writer.writeU16(height);
-    writer.writeU16(static_cast<uint16_t>(bm_fmt));
-    writer.writeU16(pal_fmt);
-    writer.writeU16(anim_tiles_width);
-    writer.writeU16(anim_tiles_height);
-    writer.writeU16(num_frames);
-    writer.writeU16(flags);
-    writer.writeS64(filename_p);
-    writer.writeU16(pal_size);
-    writer.writeU8(fps);
-    writer.writeU8(mip_levels);
-    writer.writeU32(data_size);
-    writer.writeU64(next);
-    writer.writeU64(prev);
-    writer.writeU32(cache[0]);
-    writer.writeU32(cache[1]);
-    writer.writeU64(0); // padding
+    char buffer[PEGENTRY_BINSIZE];
+    write(buffer, ByteOrder::Little);
+    stream.write(buffer, PEGENTRY_BINSIZE);
+}
+
+void PegEntry::write(char* data, ByteOrder order) const
+{
+    PegEntryLayout::write(*this, data, order);
 }
 
 void PegEntry::update_dds(const DDSHeader& dds_header)
@@ -273,12 +399,12 @@ DDSHeader PegEntry::to_dds() const
     switch (bm_fmt) {
     case TextureFormat::PC_DXT1:
         dds_header.flags |= DDSD_LINEARSIZE;
-        dds_header.pitch_or_linear_size = calc_compressed_size(width, height, 8);
+        dds_header.pitch_or_linear_size = static_cast<uint32_t>(calc_compressed_size(width, height, 8));
         break;
     case TextureFormat::PC_DXT3:
     case TextureFormat::PC_DXT5:
         dds_header.flags |= DDSD_LINEARSIZE;
-        dds_header.pitch_or_linear_size = calc_compressed_size(width, height, 16);
+        dds_header.pitch_or_linear_size = static_cast<uint32_t>(calc_compressed_size(width, height, 16));
         break;
     default:
         if (dds_header.ddspf.rgb_bit_count > 0) {
@@ -292,3 +418,77 @@ DDSHeader PegEntry::to_dds() const
 
     return dds_header;
 }
+
+const char* PegEntry::texture_data() const
+{
+    if (mapped_data != nullptr) {
+        return mapped_data;
+    }
+    return data.data();
+}
+
+ByteView PegEntry::texture_view() const
+{
+    return ByteView(texture_data(), has_data() ? data_size : 0);
+}
+
+bool PegEntry::has_data() const
+{
+    return (mapped_data != nullptr) || !data.empty();
+}
+
+// Expected size of the texture data for all mip levels and cube map faces.
+// 64 bit, so sizes that don't fit into data_size can be detected.
+uint64_t PegEntry::calc_data_size() const
+{
+    uint32_t level_width = width;
+    uint32_t level_height = height;
+    uint64_t total_size = 0;
+    for (uint8_t level = 0; level < mip_levels; level++) {
+        total_size += calc_level_size(bm_fmt, level_width, level_height);
+        level_width = std::max(1u, level_width / 2);
+        level_height = std::max(1u, level_height / 2);
+    }
+
+    if (flags & BM_F_CUBE_MAP) {
+        total_size *= 6;
+    }
+    return total_size;
+}
+
+
+
+PegHeaderView::PegHeaderView(const char* data, size_t size)
+{
+    m_names = parse_header(m_fields, data, size);
+    m_data = data;
+}
+
+PegEntry PegHeaderView::entry(size_t index) const
+{
+    if (index >= m_names.size()) {
+        throw std::out_of_range("Entry index out of range");
+    }
+    PegEntry entry;
+    entry.read(m_data + PEGHEADER_BINSIZE + PEGENTRY_BINSIZE * index, m_fields.byte_order);
+    return entry;
+}
+
+ByteView PegHeaderView::texture_data(size_t index, ByteView datafile) const
+{
+    PegEntry entry = this->entry(index);
+    if (entry.offset < 0) {
+        return ByteView();
+    }
+    return datafile.subview(static_cast<size_t>(entry.offset), entry.data_size);
+}
+
+size_t PegHeaderView::find(StringView name) const
+{
+    for (size_t entry_i = 0; entry_i < m_names.size(); entry_i++) {
+        if (m_names[entry_i] == name) {
+            return entry_i;
+        }
+    }
+    return SIZE_MAX;
+}
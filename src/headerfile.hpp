@@ -3,8 +3,11 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "common.hpp"
+#include "binlayout.hpp"
+#include "views.hpp"
 
 struct DDSHeader;
 struct PegEntry;
@@ -44,15 +47,22 @@ const uint16_t BM_F_PERM_REGISTERED = 0x2000; // bitmap is permanently registere
 
 const char* get_format_name(TextureFormat fmt);
 std::string get_entry_flag_names(uint16_t flags);
-uint32_t calc_compressed_size(uint32_t width, uint32_t height, uint32_t blocksize);
+uint64_t calc_compressed_size(uint32_t width, uint32_t height, uint32_t blocksize);
+uint64_t calc_level_size(TextureFormat fmt, uint32_t width, uint32_t height);
 
 const size_t PEGENTRY_BINSIZE = 72;
 struct PegEntry
 {
     void read(std::istream& stream);
+    void read(const char* data, ByteOrder order);
     void write(std::ostream& stream) const;
+    void write(char* data, ByteOrder order) const;
     void update_dds(const DDSHeader& dds_header);
     DDSHeader to_dds() const;
+    const char* texture_data() const;
+    ByteView texture_view() const;
+    bool has_data() const;
+    uint64_t calc_data_size() const;
 
     int64_t offset = 0; // File position of texture data
     uint16_t width = 0; // Width of texture
@@ -74,18 +84,26 @@ struct PegEntry
     // 8 bytes padding
 
     std::string filename;
-    std::vector<char> data;
+    std::vector<char> data; // Texture data owned by the entry
+    const char* mapped_data = nullptr; // Texture data inside a mapped data file
 };
 
 const size_t PEGHEADER_BINSIZE = 24;
+// Alignments repack can store, the game's own files all use 16
+const uint32_t MIN_DATA_ALIGNMENT = 16;
+const uint32_t MAX_DATA_ALIGNMENT = 32768;
 struct PegHeader
 {
     void read(std::istream& stream);
+    void read(const char* data, size_t size);
     void write(std::ostream& stream) const;
     size_t size() const;
     size_t entry_index(const std::string& name) const;
     void add_entry(PegEntry entry);
     bool remove_entry(const std::string& name);
+    size_t remove_entries(const std::unordered_set<std::string>& names);
+    void rename_entry(size_t index, const std::string& new_name);
+    void rebuild_index();
 
     uint32_t signature = FOURCC_GEKV; // Always GEKV
     int16_t version = 13; // 13 for SRTT and SRIV
@@ -95,6 +113,37 @@ struct PegHeader
     uint16_t num_bitmaps = 0; // Number of bitmaps in container.
     uint16_t flags = 0; // Various flags. Always 0
     uint16_t total_entries = 0; // Number of entries in container. Same as num_bitmaps.
-    uint16_t alignment = 16; // Always 16 for the PC.
+    uint16_t alignment = 16; // Always 16 for the PC, unless repacked with -a.
     std::vector<PegEntry> entries;
+    ByteOrder byte_order = ByteOrder::Little; // Detected from the signature
+    // Maps filenames to their index in entries. The first entry wins if a
+    // name appears twice. Call rebuild_index after changing entries directly.
+    std::unordered_map<std::string, size_t> entry_map;
+};
+
+// Read-only view of a header block in memory. Only the fixed size fields are
+// parsed, names point into the block and entries are decoded when asked for,
+// so nothing is copied. The block has to outlive the view.
+class PegHeaderView
+{
+public:
+    PegHeaderView() = default;
+    PegHeaderView(const char* data, size_t size);
+
+    // Header fields, entries is always empty
+    const PegHeader& fields() const { return m_fields; }
+    size_t entry_count() const { return m_names.size(); }
+    StringView name(size_t index) const { return m_names.at(index); }
+    // Decoded entry without name or texture data
+    PegEntry entry(size_t index) const;
+    // Texture data of an entry inside a whole data file, empty if the entry
+    // points outside of it
+    ByteView texture_data(size_t index, ByteView datafile) const;
+    // SIZE_MAX if no entry has this name
+    size_t find(StringView name) const;
+
+private:
+    const char* m_data = nullptr;
+    PegHeader m_fields;
+    std::vector<StringView> m_names;
 };
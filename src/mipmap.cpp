@@ -0,0 +1,352 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h> // memset
+#include <math.h> // powf, sinf, sqrtf, floorf, ceilf, fabsf
+#include <vector>
+#include <algorithm> // std::min, std::max
+
+#include "simd.hpp"
+#include "mipmap.hpp"
+
+// Rows of the destination level filtered as one unit of work
+const uint32_t MIP_TILE_ROWS = 16;
+// Same parameters as the Kaiser filter of NVIDIA Texture Tools
+const float KAISER_RADIUS = 3.0f;
+const float KAISER_ALPHA = 4.0f;
+const float PI = 3.14159265358979f;
+
+typedef void (*FilterRowFunc)(const float* src, float* dst, uint32_t dst_width,
+    const uint32_t* first, const uint32_t* count, const size_t* offset, const float* weights);
+typedef void (*AccumulateRowFunc)(const float* src, float weight, float* dst, size_t count);
+
+uint32_t calc_mip_count(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+    while (width > 1 || height > 1) {
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+        count++;
+    }
+    return count;
+}
+
+// Conversion tables between 8 bit sRGB and linear floats
+
+const size_t LINEAR_STEPS = 4096;
+
+struct ColorTables
+{
+    ColorTables();
+
+    float to_linear[256];
+    uint8_t to_srgb[LINEAR_STEPS];
+};
+
+ColorTables::ColorTables()
+{
+    for (size_t value = 0; value < 256; value++) {
+        float srgb = value / 255.0f;
+        if (srgb <= 0.04045f) {
+            to_linear[value] = srgb / 12.92f;
+        } else {
+            to_linear[value] = powf((srgb + 0.055f) / 1.055f, 2.4f);
+        }
+    }
+    for (size_t step = 0; step < LINEAR_STEPS; step++) {
+        float linear = step / static_cast<float>(LINEAR_STEPS - 1);
+        float srgb;
+        if (linear <= 0.0031308f) {
+            srgb = linear * 12.92f;
+        } else {
+            srgb = 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+        }
+        to_srgb[step] = static_cast<uint8_t>(srgb * 255.0f + 0.5f);
+    }
+}
+
+static const ColorTables& get_color_tables()
+{
+    static const ColorTables tables;
+    return tables;
+}
+
+static float clamp_unit(float value)
+{
+    return std::min(1.0f, std::max(0.0f, value));
+}
+
+// Filter kernels
+
+static void filter_row_scalar(const float* src, float* dst, uint32_t dst_width,
+    const uint32_t* first, const uint32_t* count, const size_t* offset, const float* weights)
+{
+    for (uint32_t x = 0; x < dst_width; x++) {
+        float sum[4] = {};
+        const float* src_pixel = src + first[x] * 4;
+        const float* pixel_weights = weights + offset[x];
+        for (uint32_t tap = 0; tap < count[x]; tap++) {
+            for (size_t ch = 0; ch < 4; ch++) {
+                sum[ch] = sum[ch] + pixel_weights[tap] * src_pixel[tap * 4 + ch];
+            }
+        }
+        memcpy(dst + x * 4, sum, sizeof(sum));
+    }
+}
+
+static void accumulate_row_scalar(const float* src, float weight, float* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = dst[i] + weight * src[i];
+    }
+}
+
+#ifdef X86_SIMD
+
+// One RGBA pixel fills a register
+TARGET_SSE2
+static void filter_row_sse2(const float* src, float* dst, uint32_t dst_width,
+    const uint32_t* first, const uint32_t* count, const size_t* offset, const float* weights)
+{
+    for (uint32_t x = 0; x < dst_width; x++) {
+        __m128 sum = _mm_setzero_ps();
+        const float* src_pixel = src + first[x] * 4;
+        const float* pixel_weights = weights + offset[x];
+        for (uint32_t tap = 0; tap < count[x]; tap++) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(pixel_weights[tap]),
+                _mm_loadu_ps(src_pixel + tap * 4)));
+        }
+        _mm_storeu_ps(dst + x * 4, sum);
+    }
+}
+
+// Rows always hold whole pixels, so count is a multiple of 4
+TARGET_SSE2
+static void accumulate_row_sse2(const float* src, float weight, float* dst, size_t count)
+{
+    __m128 weights = _mm_set1_ps(weight);
+    for (size_t i = 0; i < count; i += 4) {
+        __m128 value = _mm_add_ps(_mm_loadu_ps(dst + i),
+            _mm_mul_ps(weights, _mm_loadu_ps(src + i)));
+        _mm_storeu_ps(dst + i, value);
+    }
+}
+
+#endif
+
+struct MipKernels
+{
+    FilterRowFunc filter_row;
+    AccumulateRowFunc accumulate_row;
+};
+
+static MipKernels select_kernels()
+{
+#ifdef X86_SIMD
+    if (cpu_has_sse2()) {
+        return {filter_row_sse2, accumulate_row_sse2};
+    }
+#endif
+    return {filter_row_scalar, accumulate_row_scalar};
+}
+
+static const MipKernels& get_kernels()
+{
+    static const MipKernels kernels = select_kernels();
+    return kernels;
+}
+
+// Filter weights
+
+static float bessel_i0(float x)
+{
+    float sum = 1.0f;
+    float term = 1.0f;
+    float half_x_squared = (x / 2.0f) * (x / 2.0f);
+    for (int k = 1; k < 50; k++) {
+        term *= half_x_squared / static_cast<float>(k * k);
+        sum += term;
+        if (term < sum * 1.0e-8f) {
+            break;
+        }
+    }
+    return sum;
+}
+
+// t is the distance in destination pixels
+static float kaiser_weight(float t)
+{
+    if (fabsf(t) >= KAISER_RADIUS) {
+        return 0.0f;
+    }
+    float sinc = (t == 0.0f) ? 1.0f : sinf(PI * t) / (PI * t);
+    float x = t / KAISER_RADIUS;
+    return sinc * bessel_i0(KAISER_ALPHA * sqrtf(1.0f - x * x)) / bessel_i0(KAISER_ALPHA);
+}
+
+// Taps outside the image are moved to the edge pixel
+void MipGenerator::build_taps(uint32_t src_size, uint32_t dst_size, MipFilter filter,
+    Taps& taps)
+{
+    float scale = src_size / static_cast<float>(dst_size);
+    std::vector<float> src_weights(src_size);
+
+    taps = Taps();
+    for (uint32_t dst_i = 0; dst_i < dst_size; dst_i++) {
+        int64_t min_i = src_size;
+        int64_t max_i = -1;
+        auto add_weight = [&](int64_t src_i, float weight) {
+            src_i = std::min<int64_t>(std::max<int64_t>(src_i, 0), src_size - 1);
+            src_weights[src_i] += weight;
+            min_i = std::min(min_i, src_i);
+            max_i = std::max(max_i, src_i);
+        };
+
+        if (filter == MipFilter::Box) {
+            // Overlap of every source pixel with the destination pixel
+            float start = dst_i * scale;
+            float end = (dst_i + 1) * scale;
+            int64_t end_i = static_cast<int64_t>(ceilf(end));
+            for (int64_t src_i = static_cast<int64_t>(floorf(start)); src_i < end_i; src_i++) {
+                float overlap = std::min(end, src_i + 1.0f) - std::max(start, static_cast<float>(src_i));
+                if (overlap > 0.0f) {
+                    add_weight(src_i, overlap);
+                }
+            }
+        } else {
+            float center = (dst_i + 0.5f) * scale;
+            float reach = KAISER_RADIUS * scale;
+            int64_t end_i = static_cast<int64_t>(ceilf(center + reach));
+            for (int64_t src_i = static_cast<int64_t>(floorf(center - reach)); src_i <= end_i; src_i++) {
+                float weight = kaiser_weight((src_i + 0.5f - center) / scale);
+                if (weight != 0.0f) {
+                    add_weight(src_i, weight);
+                }
+            }
+        }
+
+        float total = 0.0f;
+        for (int64_t src_i = min_i; src_i <= max_i; src_i++) {
+            total += src_weights[src_i];
+        }
+        taps.first.push_back(static_cast<uint32_t>(min_i));
+        taps.count.push_back(static_cast<uint32_t>(max_i - min_i + 1));
+        taps.offset.push_back(taps.weights.size());
+        for (int64_t src_i = min_i; src_i <= max_i; src_i++) {
+            taps.weights.push_back(src_weights[src_i] / total);
+            src_weights[src_i] = 0.0f;
+        }
+    }
+}
+
+
+
+MipGenerator::MipGenerator(const Image& base, MipFilter filter, bool srgb)
+    : m_filter(filter), m_srgb(srgb), m_base(base)
+{
+    uint32_t width = base.width;
+    uint32_t height = base.height;
+    uint32_t count = calc_mip_count(width, height);
+    m_levels.resize(count);
+    for (Level& level : m_levels) {
+        level.width = width;
+        level.height = height;
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+
+    // Alpha is always linear
+    const ColorTables& tables = get_color_tables();
+    Level& first = m_levels[0];
+    first.pixels.resize(base.pixels.size());
+    for (size_t pos = 0; pos < base.pixels.size(); pos += 4) {
+        for (size_t ch = 0; ch < 3; ch++) {
+            uint8_t value = base.pixels[pos + ch];
+            first.pixels[pos + ch] = srgb ? tables.to_linear[value] : value / 255.0f;
+        }
+        first.pixels[pos + 3] = base.pixels[pos + 3] / 255.0f;
+    }
+}
+
+size_t MipGenerator::level_count() const
+{
+    return m_levels.size();
+}
+
+size_t MipGenerator::begin_level(size_t level_i)
+{
+    m_current = level_i;
+    const Level& src = m_levels.at(level_i - 1);
+    Level& dst = m_levels.at(level_i);
+    dst.pixels.resize(static_cast<size_t>(dst.width) * dst.height * 4);
+
+    build_taps(src.width, dst.width, m_filter, m_horizontal);
+    build_taps(src.height, dst.height, m_filter, m_vertical);
+    return (dst.height + MIP_TILE_ROWS - 1) / MIP_TILE_ROWS;
+}
+
+// Filters the source rows the tile needs horizontally, then combines them
+// vertically into the destination rows
+void MipGenerator::filter_tile(size_t tile_i)
+{
+    const MipKernels& kernels = get_kernels();
+    const Level& src = m_levels[m_current - 1];
+    Level& dst = m_levels[m_current];
+    uint32_t first_row = static_cast<uint32_t>(tile_i) * MIP_TILE_ROWS;
+    uint32_t end_row = std::min(first_row + MIP_TILE_ROWS, dst.height);
+
+    uint32_t src_first = m_vertical.first[first_row];
+    uint32_t src_end = src_first;
+    for (uint32_t y = first_row; y < end_row; y++) {
+        src_first = std::min(src_first, m_vertical.first[y]);
+        src_end = std::max(src_end, m_vertical.first[y] + m_vertical.count[y]);
+    }
+
+    size_t row_floats = static_cast<size_t>(dst.width) * 4;
+    std::vector<float> rows((src_end - src_first) * row_floats);
+    for (uint32_t src_y = src_first; src_y < src_end; src_y++) {
+        kernels.filter_row(src.pixels.data() + src_y * static_cast<size_t>(src.width) * 4,
+            rows.data() + (src_y - src_first) * row_floats, dst.width,
+            m_horizontal.first.data(), m_horizontal.count.data(),
+            m_horizontal.offset.data(), m_horizontal.weights.data());
+    }
+
+    for (uint32_t y = first_row; y < end_row; y++) {
+        float* dst_row = dst.pixels.data() + y * row_floats;
+        memset(dst_row, 0, row_floats * sizeof(float));
+        const float* row_weights = m_vertical.weights.data() + m_vertical.offset[y];
+        for (uint32_t tap = 0; tap < m_vertical.count[y]; tap++) {
+            uint32_t src_y = m_vertical.first[y] + tap;
+            kernels.accumulate_row(rows.data() + (src_y - src_first) * row_floats,
+                row_weights[tap], dst_row, row_floats);
+        }
+    }
+}
+
+std::vector<Image> MipGenerator::finish() const
+{
+    const ColorTables& tables = get_color_tables();
+    std::vector<Image> images(m_levels.size());
+    images[0] = m_base;
+    for (size_t level_i = 1; level_i < m_levels.size(); level_i++) {
+        const Level& level = m_levels[level_i];
+        Image& image = images[level_i];
+        image.width = level.width;
+        image.height = level.height;
+        image.pixels.resize(level.pixels.size());
+
+        // Kaiser overshoots near edges, so values are clamped
+        for (size_t pos = 0; pos < level.pixels.size(); pos += 4) {
+            for (size_t ch = 0; ch < 3; ch++) {
+                float value = clamp_unit(level.pixels[pos + ch]);
+                if (m_srgb) {
+                    size_t step = static_cast<size_t>(value * (LINEAR_STEPS - 1) + 0.5f);
+                    image.pixels[pos + ch] = tables.to_srgb[step];
+                } else {
+                    image.pixels[pos + ch] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+                }
+            }
+            image.pixels[pos + 3] = static_cast<uint8_t>(clamp_unit(level.pixels[pos + 3]) * 255.0f + 0.5f);
+        }
+    }
+    return images;
+}
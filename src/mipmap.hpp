@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "texture.hpp"
+
+enum class MipFilter
+{
+    Box, // Average of the covered source pixels
+    Kaiser // Kaiser windowed sinc, sharper than box
+};
+
+// Number of levels in a full chain down to 1x1, including the base level
+uint32_t calc_mip_count(uint32_t width, uint32_t height);
+
+// Builds the full mip chain of an image. Filtering happens on linear light
+// values, sRGB images are converted before and after. Dimensions that aren't
+// a power of 2 are rounded down when halving, every level still covers the
+// whole image.
+//
+// Each level is made from the previous one, so levels have to be built in
+// order. begin_level splits a level into tiles of rows and filter_tile can
+// be called from several threads for different tiles of the same level.
+class MipGenerator
+{
+public:
+    MipGenerator(const Image& base, MipFilter filter, bool srgb);
+
+    size_t level_count() const;
+    // Prepares level_i (1 to level_count - 1) and returns its tile count
+    size_t begin_level(size_t level_i);
+    void filter_tile(size_t tile_i);
+    // Converts the levels back to 8 bit, the base level is copied
+    std::vector<Image> finish() const;
+
+private:
+    // Source pixels and weights for every pixel along one axis
+    struct Taps
+    {
+        std::vector<uint32_t> first;
+        std::vector<uint32_t> count;
+        std::vector<size_t> offset; // Into weights
+        std::vector<float> weights;
+    };
+
+    struct Level
+    {
+        uint32_t width;
+        uint32_t height;
+        std::vector<float> pixels; // Linear R, G, B, A
+    };
+
+    MipFilter m_filter;
+    bool m_srgb;
+    const Image& m_base;
+    static void build_taps(uint32_t src_size, uint32_t dst_size, MipFilter filter,
+        Taps& taps);
+
+    std::vector<Level> m_levels;
+    size_t m_current = 0;
+    Taps m_horizontal;
+    Taps m_vertical;
+};
@@ -1,4 +1,5 @@
 #pragma once
+#include <stdint.h>
 #include <stddef.h>
 #include <string>
 
@@ -75,6 +76,27 @@ inline bool exists(const std::string& filename)
     uint32_t attributes = GetFileAttributes(filename.c_str());
     return (attributes != 0xFFFFFFFF);
 }
+
+// Returns -1 if the file doesn't exist
+inline int64_t file_size(const std::string& filename)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes)) {
+        return -1;
+    }
+    return (static_cast<int64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+}
+
+// Last modification time in 100 ns units, -1 if the file doesn't exist
+inline int64_t modified_time(const std::string& filename)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes)) {
+        return -1;
+    }
+    return (static_cast<int64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) |
+        attributes.ftLastWriteTime.dwLowDateTime;
+}
 #else
 inline bool exists(const std::string& filename)
 {
@@ -82,6 +104,30 @@ inline bool exists(const std::string& filename)
     int error = stat(filename.c_str(), &buffer);
     return (error == 0);
 }
+
+// Returns -1 if the file doesn't exist
+inline int64_t file_size(const std::string& filename)
+{
+    struct stat buffer;
+    if (stat(filename.c_str(), &buffer) != 0) {
+        return -1;
+    }
+    return buffer.st_size;
+}
+
+// Last modification time in ns, -1 if the file doesn't exist
+inline int64_t modified_time(const std::string& filename)
+{
+    struct stat buffer;
+    if (stat(filename.c_str(), &buffer) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    return static_cast<int64_t>(buffer.st_mtimespec.tv_sec) * 1000000000 + buffer.st_mtimespec.tv_nsec;
+#else
+    return static_cast<int64_t>(buffer.st_mtim.tv_sec) * 1000000000 + buffer.st_mtim.tv_nsec;
+#endif
+}
 #endif
 
 } // namespace path
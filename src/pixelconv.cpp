@@ -0,0 +1,543 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h> // memcpy
+#include <math.h> // sqrtf
+
+#include "simd.hpp"
+#include "headerfile.hpp"
+#include "pixelconv.hpp"
+
+typedef void (*ConvertFunc)(const uint8_t* src, size_t count, uint8_t* dst);
+
+// Packed formats are little endian on disk
+
+static uint32_t load_le16(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static void store_le16(uint8_t* data, uint32_t value)
+{
+    data[0] = static_cast<uint8_t>(value);
+    data[1] = static_cast<uint8_t>(value >> 8);
+}
+
+// Rounds value * max / 255
+static uint32_t quantize(uint32_t value, uint32_t max)
+{
+    return (value * max + 127) / 255;
+}
+
+// Scalar kernels, also used for the pixels left over by the SIMD kernels
+
+static void swizzle_8888_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint8_t pixel[4] = {src[i * 4 + 2], src[i * 4 + 1], src[i * 4], src[i * 4 + 3]};
+        memcpy(dst + i * 4, pixel, 4);
+    }
+}
+
+static void unpack_565_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value = load_le16(src + i * 2);
+        uint32_t r = (value >> 11) & 0x1F;
+        uint32_t g = (value >> 5) & 0x3F;
+        uint32_t b = value & 0x1F;
+        dst[i * 4] = static_cast<uint8_t>((r << 3) | (r >> 2));
+        dst[i * 4 + 1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+        dst[i * 4 + 2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+static void pack_565_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t r = quantize(src[i * 4], 31);
+        uint32_t g = quantize(src[i * 4 + 1], 63);
+        uint32_t b = quantize(src[i * 4 + 2], 31);
+        store_le16(dst + i * 2, (r << 11) | (g << 5) | b);
+    }
+}
+
+static void unpack_1555_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value = load_le16(src + i * 2);
+        uint32_t r = (value >> 10) & 0x1F;
+        uint32_t g = (value >> 5) & 0x1F;
+        uint32_t b = value & 0x1F;
+        dst[i * 4] = static_cast<uint8_t>((r << 3) | (r >> 2));
+        dst[i * 4 + 1] = static_cast<uint8_t>((g << 3) | (g >> 2));
+        dst[i * 4 + 2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+        dst[i * 4 + 3] = (value & 0x8000) ? 0xFF : 0;
+    }
+}
+
+static void pack_1555_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t r = quantize(src[i * 4], 31);
+        uint32_t g = quantize(src[i * 4 + 1], 31);
+        uint32_t b = quantize(src[i * 4 + 2], 31);
+        uint32_t a = (src[i * 4 + 3] >= 128) ? 1 : 0;
+        store_le16(dst + i * 2, (a << 15) | (r << 10) | (g << 5) | b);
+    }
+}
+
+static void unpack_4444_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value = load_le16(src + i * 2);
+        dst[i * 4] = static_cast<uint8_t>(((value >> 8) & 0xF) * 17);
+        dst[i * 4 + 1] = static_cast<uint8_t>(((value >> 4) & 0xF) * 17);
+        dst[i * 4 + 2] = static_cast<uint8_t>((value & 0xF) * 17);
+        dst[i * 4 + 3] = static_cast<uint8_t>(((value >> 12) & 0xF) * 17);
+    }
+}
+
+static void pack_4444_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t r = quantize(src[i * 4], 15);
+        uint32_t g = quantize(src[i * 4 + 1], 15);
+        uint32_t b = quantize(src[i * 4 + 2], 15);
+        uint32_t a = quantize(src[i * 4 + 3], 15);
+        store_le16(dst + i * 2, (a << 12) | (r << 8) | (g << 4) | b);
+    }
+}
+
+static void unpack_888(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i * 4] = src[i * 3 + 2];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3];
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+static void pack_888(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i * 3] = src[i * 4 + 2];
+        dst[i * 3 + 1] = src[i * 4 + 1];
+        dst[i * 3 + 2] = src[i * 4];
+    }
+}
+
+static void unpack_v8u8_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i * 4] = src[i * 2] ^ 0x80;
+        dst[i * 4 + 1] = src[i * 2 + 1] ^ 0x80;
+        dst[i * 4 + 2] = 0;
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+static void pack_v8u8_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i * 2] = src[i * 4] ^ 0x80;
+        dst[i * 2 + 1] = src[i * 4 + 1] ^ 0x80;
+    }
+}
+
+// Z of a unit normal from its X and Y
+static void unpack_cxv8u8(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        float x = static_cast<int8_t>(src[i * 2]) / 127.0f;
+        float y = static_cast<int8_t>(src[i * 2 + 1]) / 127.0f;
+        float z_squared = 1.0f - x * x - y * y;
+        float z = (z_squared > 0.0f) ? sqrtf(z_squared) : 0.0f;
+        dst[i * 4] = src[i * 2] ^ 0x80;
+        dst[i * 4 + 1] = src[i * 2 + 1] ^ 0x80;
+        dst[i * 4 + 2] = static_cast<uint8_t>(z * 127.0f + 128.5f);
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+static void unpack_a8_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i * 4] = 0;
+        dst[i * 4 + 1] = 0;
+        dst[i * 4 + 2] = 0;
+        dst[i * 4 + 3] = src[i];
+    }
+}
+
+static void pack_a8_scalar(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = src[i * 4 + 3];
+    }
+}
+
+#ifdef X86_SIMD
+
+// The SIMD kernels convert 8 pixels per iteration and leave the rest to the
+// scalar kernels. A RGBA8 pixel is a little endian uint32 in a 32 bit lane.
+
+// Sign extends the low 16 bits of every lane, so packs_epi32 can't saturate
+TARGET_SSE2
+static inline __m128i pack_low16(__m128i lo, __m128i hi)
+{
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+
+// Rounds value * max / 255 for 16 bit lanes
+TARGET_SSE2
+static inline __m128i quantize_epi16(__m128i value, int max)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(value, _mm_set1_epi16(static_cast<short>(max))),
+        _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// Splits 8 RGBA pixels into 16 bit lanes per channel
+TARGET_SSE2
+static inline void split_channels(const uint8_t* src, __m128i channels[4])
+{
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+    const __m128i byte_mask = _mm_set1_epi32(0xFF);
+    for (int ch = 0; ch < 4; ch++) {
+        channels[ch] = _mm_packs_epi32(
+            _mm_and_si128(_mm_srli_epi32(lo, 8 * ch), byte_mask),
+            _mm_and_si128(_mm_srli_epi32(hi, 8 * ch), byte_mask));
+    }
+}
+
+// Joins 16 bit lanes of R | G << 8 and B | A << 8 into 8 RGBA pixels
+TARGET_SSE2
+static inline void join_channels(__m128i rg, __m128i ba, uint8_t* dst)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi16(rg, ba));
+}
+
+TARGET_SSE2
+static void swizzle_8888_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    const __m128i keep_mask = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+    const __m128i byte_mask = _mm_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i result = _mm_or_si128(_mm_and_si128(pixels, keep_mask),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 16), byte_mask),
+                _mm_slli_epi32(_mm_and_si128(pixels, byte_mask), 16)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), result);
+    }
+    swizzle_8888_scalar(src + i * 4, count - i, dst + i * 4);
+}
+
+TARGET_SSE2
+static void unpack_565_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    const __m128i mask6 = _mm_set1_epi16(0x3F);
+    const __m128i alpha = _mm_set1_epi16(static_cast<short>(0xFF00));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        __m128i r = _mm_srli_epi16(value, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(value, 5), mask6);
+        __m128i b = _mm_and_si128(value, mask5);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        join_channels(_mm_or_si128(r, _mm_slli_epi16(g, 8)), _mm_or_si128(b, alpha),
+            dst + i * 4);
+    }
+    unpack_565_scalar(src + i * 2, count - i, dst + i * 4);
+}
+
+TARGET_SSE2
+static void pack_565_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i channels[4];
+        split_channels(src + i * 4, channels);
+        __m128i r = quantize_epi16(channels[0], 31);
+        __m128i g = quantize_epi16(channels[1], 63);
+        __m128i b = quantize_epi16(channels[2], 31);
+        __m128i value = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), value);
+    }
+    pack_565_scalar(src + i * 4, count - i, dst + i * 2);
+}
+
+TARGET_SSE2
+static void unpack_1555_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        __m128i r = _mm_and_si128(_mm_srli_epi16(value, 10), mask5);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(value, 5), mask5);
+        __m128i b = _mm_and_si128(value, mask5);
+        // Arithmetic shift turns the alpha bit into 0 or 0xFF00
+        __m128i a = _mm_slli_epi16(_mm_srai_epi16(value, 15), 8);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        join_channels(_mm_or_si128(r, _mm_slli_epi16(g, 8)), _mm_or_si128(b, a), dst + i * 4);
+    }
+    unpack_1555_scalar(src + i * 2, count - i, dst + i * 4);
+}
+
+TARGET_SSE2
+static void pack_1555_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i channels[4];
+        split_channels(src + i * 4, channels);
+        __m128i r = quantize_epi16(channels[0], 31);
+        __m128i g = quantize_epi16(channels[1], 31);
+        __m128i b = quantize_epi16(channels[2], 31);
+        __m128i a = _mm_slli_epi16(_mm_srli_epi16(channels[3], 7), 15);
+        __m128i value = _mm_or_si128(_mm_or_si128(a, _mm_slli_epi16(r, 10)),
+            _mm_or_si128(_mm_slli_epi16(g, 5), b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), value);
+    }
+    pack_1555_scalar(src + i * 4, count - i, dst + i * 2);
+}
+
+TARGET_SSE2
+static void unpack_4444_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    const __m128i mask4 = _mm_set1_epi16(0xF);
+    const __m128i seventeen = _mm_set1_epi16(17);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        __m128i r = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(value, 8), mask4), seventeen);
+        __m128i g = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(value, 4), mask4), seventeen);
+        __m128i b = _mm_mullo_epi16(_mm_and_si128(value, mask4), seventeen);
+        __m128i a = _mm_mullo_epi16(_mm_srli_epi16(value, 12), seventeen);
+        join_channels(_mm_or_si128(r, _mm_slli_epi16(g, 8)), _mm_or_si128(b, _mm_slli_epi16(a, 8)),
+            dst + i * 4);
+    }
+    unpack_4444_scalar(src + i * 2, count - i, dst + i * 4);
+}
+
+TARGET_SSE2
+static void pack_4444_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i channels[4];
+        split_channels(src + i * 4, channels);
+        __m128i r = quantize_epi16(channels[0], 15);
+        __m128i g = quantize_epi16(channels[1], 15);
+        __m128i b = quantize_epi16(channels[2], 15);
+        __m128i a = quantize_epi16(channels[3], 15);
+        __m128i value = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(a, 12), _mm_slli_epi16(r, 8)),
+            _mm_or_si128(_mm_slli_epi16(g, 4), b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), value);
+    }
+    pack_4444_scalar(src + i * 4, count - i, dst + i * 2);
+}
+
+TARGET_SSE2
+static void unpack_v8u8_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8080));
+    const __m128i alpha = _mm_set1_epi16(static_cast<short>(0xFF00));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        join_channels(_mm_xor_si128(value, bias), alpha, dst + i * 4);
+    }
+    unpack_v8u8_scalar(src + i * 2, count - i, dst + i * 4);
+}
+
+TARGET_SSE2
+static void pack_v8u8_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8080));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4 + 16));
+        __m128i value = _mm_xor_si128(pack_low16(lo, hi), bias);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), value);
+    }
+    pack_v8u8_scalar(src + i * 4, count - i, dst + i * 2);
+}
+
+TARGET_SSE2
+static void unpack_a8_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(zero, value);
+        __m128i hi = _mm_unpackhi_epi8(zero, value);
+        __m128i* out = reinterpret_cast<__m128i*>(dst + i * 4);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(zero, lo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(zero, lo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(zero, hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(zero, hi));
+    }
+    unpack_a8_scalar(src + i, count - i, dst + i * 4);
+}
+
+TARGET_SSE2
+static void pack_a8_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i* in = reinterpret_cast<const __m128i*>(src + i * 4);
+        __m128i words_lo = _mm_packs_epi32(_mm_srli_epi32(_mm_loadu_si128(in), 24),
+            _mm_srli_epi32(_mm_loadu_si128(in + 1), 24));
+        __m128i words_hi = _mm_packs_epi32(_mm_srli_epi32(_mm_loadu_si128(in + 2), 24),
+            _mm_srli_epi32(_mm_loadu_si128(in + 3), 24));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(words_lo, words_hi));
+    }
+    pack_a8_scalar(src + i * 4, count - i, dst + i);
+}
+
+#endif
+
+struct PixelKernels
+{
+    ConvertFunc swizzle_8888; // Works in both directions
+    ConvertFunc unpack_565;
+    ConvertFunc pack_565;
+    ConvertFunc unpack_1555;
+    ConvertFunc pack_1555;
+    ConvertFunc unpack_4444;
+    ConvertFunc pack_4444;
+    ConvertFunc unpack_v8u8;
+    ConvertFunc pack_v8u8;
+    ConvertFunc unpack_a8;
+    ConvertFunc pack_a8;
+    const char* name;
+};
+
+static PixelKernels select_kernels()
+{
+#ifdef X86_SIMD
+    if (cpu_has_sse2()) {
+        return {swizzle_8888_sse2, unpack_565_sse2, pack_565_sse2, unpack_1555_sse2,
+            pack_1555_sse2, unpack_4444_sse2, pack_4444_sse2, unpack_v8u8_sse2,
+            pack_v8u8_sse2, unpack_a8_sse2, pack_a8_sse2, "sse2"};
+    }
+#endif
+    return {swizzle_8888_scalar, unpack_565_scalar, pack_565_scalar, unpack_1555_scalar,
+        pack_1555_scalar, unpack_4444_scalar, pack_4444_scalar, unpack_v8u8_scalar,
+        pack_v8u8_scalar, unpack_a8_scalar, pack_a8_scalar, "scalar"};
+}
+
+static const PixelKernels& get_kernels()
+{
+    static const PixelKernels kernels = select_kernels();
+    return kernels;
+}
+
+const char* get_pixel_kernel_name()
+{
+    return get_kernels().name;
+}
+
+bool is_uncompressed_format(TextureFormat fmt)
+{
+    return get_pixel_size(fmt) != 0;
+}
+
+size_t get_pixel_size(TextureFormat fmt)
+{
+    switch (fmt) {
+    case TextureFormat::PC_565:
+    case TextureFormat::PC_1555:
+    case TextureFormat::PC_4444:
+    case TextureFormat::PC_16_DUDV:
+    case TextureFormat::PC_16_DOT3_COMPRESSED:
+        return 2;
+    case TextureFormat::PC_888:
+        return 3;
+    case TextureFormat::PC_8888:
+        return 4;
+    case TextureFormat::PC_A8:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void unpack_pixels(TextureFormat fmt, const uint8_t* src, size_t count, uint8_t* rgba)
+{
+    const PixelKernels& kernels = get_kernels();
+    switch (fmt) {
+    case TextureFormat::PC_565:
+        kernels.unpack_565(src, count, rgba);
+        break;
+    case TextureFormat::PC_1555:
+        kernels.unpack_1555(src, count, rgba);
+        break;
+    case TextureFormat::PC_4444:
+        kernels.unpack_4444(src, count, rgba);
+        break;
+    case TextureFormat::PC_888:
+        unpack_888(src, count, rgba);
+        break;
+    case TextureFormat::PC_8888:
+        kernels.swizzle_8888(src, count, rgba);
+        break;
+    case TextureFormat::PC_16_DUDV:
+        kernels.unpack_v8u8(src, count, rgba);
+        break;
+    case TextureFormat::PC_16_DOT3_COMPRESSED:
+        unpack_cxv8u8(src, count, rgba);
+        break;
+    case TextureFormat::PC_A8:
+        kernels.unpack_a8(src, count, rgba);
+        break;
+    default:
+        break;
+    }
+}
+
+void pack_pixels(TextureFormat fmt, const uint8_t* rgba, size_t count, uint8_t* dst)
+{
+    const PixelKernels& kernels = get_kernels();
+    switch (fmt) {
+    case TextureFormat::PC_565:
+        kernels.pack_565(rgba, count, dst);
+        break;
+    case TextureFormat::PC_1555:
+        kernels.pack_1555(rgba, count, dst);
+        break;
+    case TextureFormat::PC_4444:
+        kernels.pack_4444(rgba, count, dst);
+        break;
+    case TextureFormat::PC_888:
+        pack_888(rgba, count, dst);
+        break;
+    case TextureFormat::PC_8888:
+        kernels.swizzle_8888(rgba, count, dst);
+        break;
+    case TextureFormat::PC_16_DUDV:
+    case TextureFormat::PC_16_DOT3_COMPRESSED:
+        kernels.pack_v8u8(rgba, count, dst);
+        break;
+    case TextureFormat::PC_A8:
+        kernels.pack_a8(rgba, count, dst);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+enum class TextureFormat;
+
+// Conversion between the uncompressed texture formats and RGBA8 (bytes in
+// the order R, G, B, A). Missing channels unpack as 0, missing alpha as 255.
+// V8U8 and CxV8U8 store signed values, they are biased by 128 into red and
+// green. CxV8U8 also gets the reconstructed Z in blue.
+
+bool is_uncompressed_format(TextureFormat fmt);
+// Bytes per pixel, 0 for block compressed and unknown formats
+size_t get_pixel_size(TextureFormat fmt);
+
+void unpack_pixels(TextureFormat fmt, const uint8_t* src, size_t count, uint8_t* rgba);
+void pack_pixels(TextureFormat fmt, const uint8_t* rgba, size_t count, uint8_t* dst);
+
+// Name of the kernel implementation picked for this CPU
+const char* get_pixel_kernel_name();
@@ -0,0 +1,24 @@
+#pragma once
+
+// x86 SIMD helpers. Functions using instructions above the compiler's
+// baseline are marked with a target attribute and are only called after
+// checking the CPU at runtime, so one binary runs everywhere.
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+inline bool cpu_has_sse2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+inline bool cpu_has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
@@ -0,0 +1,153 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "stats.hpp"
+
+std::atomic<bool> g_stats_enabled(false);
+
+struct PhaseStats
+{
+    std::atomic<uint64_t> nanoseconds;
+    std::atomic<uint64_t> calls;
+};
+
+static PhaseStats g_phases[static_cast<size_t>(StatPhase::Count)];
+static std::atomic<uint64_t> g_counters[static_cast<size_t>(StatCounter::Count)];
+static std::chrono::steady_clock::time_point g_start;
+
+static const char* PHASE_NAMES[] = {
+    "read_header",
+    "write_header",
+    "read_data",
+    "write_data",
+    "read_sources",
+    "decode",
+    "mipmaps",
+    "encode",
+    "write_textures"
+};
+
+static const char* COUNTER_NAMES[] = {
+    "bytes_read",
+    "bytes_written",
+    "bytes_mapped",
+    "read_calls",
+    "write_calls",
+    "copy_calls",
+    "map_calls"
+};
+
+static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) ==
+    static_cast<size_t>(StatPhase::Count), "Phase names don't match");
+static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]) ==
+    static_cast<size_t>(StatCounter::Count), "Counter names don't match");
+
+void enable_stats()
+{
+    for (PhaseStats& phase : g_phases) {
+        phase.nanoseconds = 0;
+        phase.calls = 0;
+    }
+    for (std::atomic<uint64_t>& counter : g_counters) {
+        counter = 0;
+    }
+    g_start = std::chrono::steady_clock::now();
+    g_stats_enabled = true;
+}
+
+void add_phase_time(StatPhase phase, uint64_t nanoseconds)
+{
+    PhaseStats& stats = g_phases[static_cast<size_t>(phase)];
+    stats.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    stats.calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void add_counter_slow(StatCounter counter, uint64_t value)
+{
+    g_counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t get_peak_rss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss); // Bytes
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // Kilobytes
+#endif
+#endif
+}
+
+static double get_total_ms()
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - g_start;
+    return elapsed.count();
+}
+
+void print_stats(std::ostream& stream)
+{
+    std::ios::fmtflags old_flags = stream.flags();
+    stream << std::fixed << std::setprecision(3);
+    stream << "Stats:" << std::endl;
+    stream << "  " << std::left << std::setw(20) << "total" << std::right <<
+        std::setw(14) << get_total_ms() << " ms" << std::endl;
+    for (size_t phase_i = 0; phase_i < static_cast<size_t>(StatPhase::Count); phase_i++) {
+        const PhaseStats& phase = g_phases[phase_i];
+        if (phase.calls == 0) {
+            continue;
+        }
+        stream << "  " << std::left << std::setw(20) << PHASE_NAMES[phase_i] << std::right <<
+            std::setw(14) << phase.nanoseconds / 1e6 << " ms  (" << phase.calls << "x)" << std::endl;
+    }
+    for (size_t counter_i = 0; counter_i < static_cast<size_t>(StatCounter::Count); counter_i++) {
+        stream << "  " << std::left << std::setw(20) << COUNTER_NAMES[counter_i] << std::right <<
+            std::setw(14) << g_counters[counter_i] << std::endl;
+    }
+    stream << "  " << std::left << std::setw(20) << "peak_rss" << std::right <<
+        std::setw(14) << get_peak_rss() << " bytes" << std::endl;
+    stream.flags(old_flags);
+}
+
+void print_stats_json(std::ostream& stream)
+{
+    std::ios::fmtflags old_flags = stream.flags();
+    stream << std::fixed << std::setprecision(3);
+    stream << "{\"total_ms\": " << get_total_ms() << ", \"phases\": {";
+    bool first = true;
+    for (size_t phase_i = 0; phase_i < static_cast<size_t>(StatPhase::Count); phase_i++) {
+        const PhaseStats& phase = g_phases[phase_i];
+        if (phase.calls == 0) {
+            continue;
+        }
+        stream << (first ? "" : ", ") << "\"" << PHASE_NAMES[phase_i] << "\": {\"ms\": " <<
+            phase.nanoseconds / 1e6 << ", \"calls\": " << phase.calls << "}";
+        first = false;
+    }
+    stream << "}";
+    for (size_t counter_i = 0; counter_i < static_cast<size_t>(StatCounter::Count); counter_i++) {
+        stream << ", \"" << COUNTER_NAMES[counter_i] << "\": " << g_counters[counter_i];
+    }
+    stream << ", \"peak_rss_bytes\": " << get_peak_rss() << "}" << std::endl;
+    stream.flags(old_flags);
+}
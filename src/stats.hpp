@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+
+// Instrumentation for --stats. Timers and counters do nothing but check a
+// flag until enable_stats is called, so they can stay in the hot paths.
+
+enum class StatPhase
+{
+    ReadHeader,
+    WriteHeader,
+    ReadData,
+    WriteData,
+    ReadSources,
+    Decode,
+    Mipmaps,
+    Encode,
+    WriteTextures,
+    Count
+};
+
+enum class StatCounter
+{
+    BytesRead,
+    BytesWritten,
+    BytesMapped,
+    ReadCalls, // OS calls made by RawFile and MappedFile
+    WriteCalls,
+    CopyCalls,
+    MapCalls,
+    Count
+};
+
+extern std::atomic<bool> g_stats_enabled;
+
+// Call before starting any threads
+void enable_stats();
+
+inline bool stats_enabled()
+{
+    return g_stats_enabled.load(std::memory_order_relaxed);
+}
+
+void add_phase_time(StatPhase phase, uint64_t nanoseconds);
+void add_counter_slow(StatCounter counter, uint64_t value);
+
+inline void add_counter(StatCounter counter, uint64_t value)
+{
+    if (stats_enabled()) {
+        add_counter_slow(counter, value);
+    }
+}
+
+// Adds the time until the end of the scope to a phase. Phases that run on
+// several threads at once add up to more than the wall time.
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(StatPhase phase)
+        : m_phase(phase), m_enabled(stats_enabled())
+    {
+        if (m_enabled) {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopedTimer()
+    {
+        if (m_enabled) {
+            auto elapsed = std::chrono::steady_clock::now() - m_start;
+            add_phase_time(m_phase, static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    StatPhase m_phase;
+    bool m_enabled;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Peak resident set size of the process in bytes, 0 if unknown
+uint64_t get_peak_rss();
+
+// Prints the phases that ran, the counters and the peak RSS
+void print_stats(std::ostream& stream);
+void print_stats_json(std::ostream& stream);
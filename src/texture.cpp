@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <algorithm> // std::min, std::max
+#include <stdexcept> // std::runtime_error
+
+#include "headerfile.hpp"
+#include "dxt.hpp"
+#include "pixelconv.hpp"
+#include "texture.hpp"
+
+bool can_decode_format(TextureFormat fmt)
+{
+    switch (fmt) {
+    case TextureFormat::PC_DXT1:
+    case TextureFormat::PC_DXT3:
+    case TextureFormat::PC_DXT5:
+        return true;
+    default:
+        return is_uncompressed_format(fmt);
+    }
+}
+
+// Rows of blocks or pixels encoded as one unit of work
+const uint32_t TILE_ROWS = 16;
+
+bool can_encode_format(TextureFormat fmt)
+{
+    return can_decode_format(fmt);
+}
+
+bool image_has_alpha(const Image& image)
+{
+    for (size_t pos = 3; pos < image.pixels.size(); pos += 4) {
+        if (image.pixels[pos] != 0xFF) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void decode_level(TextureFormat fmt, const uint8_t* data, Image& image)
+{
+    size_t pixel_count = static_cast<size_t>(image.width) * image.height;
+    uint8_t* dest = image.pixels.data();
+
+    switch (fmt) {
+    case TextureFormat::PC_DXT1:
+        decode_dxt_level(DXTFormat::DXT1, data, image.width, image.height, dest);
+        break;
+    case TextureFormat::PC_DXT3:
+        decode_dxt_level(DXTFormat::DXT3, data, image.width, image.height, dest);
+        break;
+    case TextureFormat::PC_DXT5:
+        decode_dxt_level(DXTFormat::DXT5, data, image.width, image.height, dest);
+        break;
+    default:
+        unpack_pixels(fmt, data, pixel_count, dest);
+        break;
+    }
+}
+
+std::vector<Image> decode_texture(const PegEntry& entry)
+{
+    if (!can_decode_format(entry.bm_fmt)) {
+        throw std::runtime_error(std::string("Can't decode textures with format ") +
+            get_format_name(entry.bm_fmt));
+    }
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(entry.texture_data());
+    uint32_t level_width = entry.width;
+    uint32_t level_height = entry.height;
+    size_t pos = 0;
+
+    std::vector<Image> levels(std::max<uint8_t>(entry.mip_levels, 1));
+    for (Image& level : levels) {
+        size_t level_size = static_cast<size_t>(calc_level_size(entry.bm_fmt, level_width, level_height));
+        if (pos + level_size > entry.data_size) {
+            throw std::runtime_error("Texture data is smaller than its mip levels");
+        }
+
+        level.width = level_width;
+        level.height = level_height;
+        level.pixels.resize(static_cast<size_t>(level_width) * level_height * 4);
+        decode_level(entry.bm_fmt, data + pos, level);
+
+        pos += level_size;
+        level_width = std::max(1u, level_width / 2);
+        level_height = std::max(1u, level_height / 2);
+    }
+
+    return levels;
+}
+
+
+
+TextureEncoder::TextureEncoder(const std::vector<Image>& levels, TextureFormat fmt,
+    EncodeQuality quality)
+{
+    if (!can_encode_format(fmt)) {
+        throw std::runtime_error(std::string("Can't encode textures with format ") +
+            get_format_name(fmt));
+    }
+
+    m_format = fmt;
+    m_quality = quality;
+
+    size_t offset = 0;
+    for (const Image& level : levels) {
+        uint32_t rows = level.height;
+        if (fmt == TextureFormat::PC_DXT1 || fmt == TextureFormat::PC_DXT3 ||
+                fmt == TextureFormat::PC_DXT5) {
+            rows = (level.height + 3) / 4;
+        }
+        for (uint32_t first_row = 0; first_row < rows; first_row += TILE_ROWS) {
+            Tile tile;
+            tile.level = &level;
+            tile.offset = offset;
+            tile.first_row = first_row;
+            tile.row_count = std::min(TILE_ROWS, rows - first_row);
+            m_tiles.push_back(tile);
+        }
+        offset += static_cast<size_t>(calc_level_size(fmt, level.width, level.height));
+    }
+    m_data.resize(offset);
+}
+
+size_t TextureEncoder::tile_count() const
+{
+    return m_tiles.size();
+}
+
+void TextureEncoder::encode_tile(size_t tile_i)
+{
+    const Tile& tile = m_tiles.at(tile_i);
+    const Image& level = *tile.level;
+    uint8_t* dest = reinterpret_cast<uint8_t*>(m_data.data()) + tile.offset;
+    size_t first_pixel = static_cast<size_t>(tile.first_row) * level.width;
+    size_t pixel_count = static_cast<size_t>(tile.row_count) * level.width;
+    const uint8_t* src = level.pixels.data() + first_pixel * 4;
+
+    switch (m_format) {
+    case TextureFormat::PC_DXT1:
+        encode_dxt_rows(DXTFormat::DXT1, level.pixels.data(), level.width, level.height,
+            tile.first_row, tile.row_count, dest, m_quality);
+        break;
+    case TextureFormat::PC_DXT3:
+        encode_dxt_rows(DXTFormat::DXT3, level.pixels.data(), level.width, level.height,
+            tile.first_row, tile.row_count, dest, m_quality);
+        break;
+    case TextureFormat::PC_DXT5:
+        encode_dxt_rows(DXTFormat::DXT5, level.pixels.data(), level.width, level.height,
+            tile.first_row, tile.row_count, dest, m_quality);
+        break;
+    default:
+        dest += first_pixel * get_pixel_size(m_format);
+        pack_pixels(m_format, src, pixel_count, dest);
+        break;
+    }
+}
+
+std::vector<char>& TextureEncoder::data()
+{
+    return m_data;
+}
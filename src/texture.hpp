@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "dxt.hpp"
+
+struct PegEntry;
+enum class TextureFormat;
+
+// Uncompressed image with 4 bytes per pixel in the order R, G, B, A
+struct Image
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+bool can_decode_format(TextureFormat fmt);
+bool can_encode_format(TextureFormat fmt);
+bool image_has_alpha(const Image& image);
+
+// Decodes every mip level of the entry's texture data, the base level comes
+// first. Cube maps only return the first face. Throws std::runtime_error if
+// the format isn't supported or the data is too short.
+std::vector<Image> decode_texture(const PegEntry& entry);
+
+// Encodes mip levels into texture data. The levels are split into tiles of
+// rows, encode_tile can be called from several threads as long as every
+// tile is only encoded once. The levels must stay alive until all tiles are
+// done.
+class TextureEncoder
+{
+public:
+    TextureEncoder(const std::vector<Image>& levels, TextureFormat fmt, EncodeQuality quality);
+
+    size_t tile_count() const;
+    void encode_tile(size_t tile_i);
+    std::vector<char>& data();
+
+private:
+    struct Tile
+    {
+        const Image* level;
+        size_t offset; // Start of the level in the texture data
+        uint32_t first_row; // Rows of blocks for DXT, else rows of pixels
+        uint32_t row_count;
+    };
+
+    TextureFormat m_format;
+    EncodeQuality m_quality;
+    std::vector<Tile> m_tiles;
+    std::vector<char> m_data;
+};
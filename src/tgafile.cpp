@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <iostream>
+#include <string>
+#include <algorithm> // std::min, std::swap_ranges
+#include <string.h> // memcpy
+
+#include "binlayout.hpp"
+#include "errors.hpp"
+#include "texture.hpp"
+#include "tgafile.hpp"
+
+// Documentation of TGA format:
+// http://www.dca.fee.unicamp.br/~martino/disciplinas/ea978/tgaffs.pdf
+
+typedef Layout<TGAHeader,
+    LAYOUT_FIELD(TGAHeader, id_length),
+    LAYOUT_FIELD(TGAHeader, colormap_type),
+    LAYOUT_FIELD(TGAHeader, image_type),
+    LAYOUT_FIELD(TGAHeader, colormap_first),
+    LAYOUT_FIELD(TGAHeader, colormap_length),
+    LAYOUT_FIELD(TGAHeader, colormap_depth),
+    LAYOUT_FIELD(TGAHeader, x_origin),
+    LAYOUT_FIELD(TGAHeader, y_origin),
+    LAYOUT_FIELD(TGAHeader, width),
+    LAYOUT_FIELD(TGAHeader, height),
+    LAYOUT_FIELD(TGAHeader, bits_per_pixel),
+    LAYOUT_FIELD(TGAHeader, descriptor)
+> TGAHeaderLayout;
+static_assert(TGAHeaderLayout::size == TGA_HEADER_SIZE, "TGA header layout size mismatch");
+
+void TGAHeader::read(std::istream& stream)
+{
+    char buffer[TGA_HEADER_SIZE];
+    stream.read(buffer, sizeof(buffer));
+    TGAHeaderLayout::read(*this, buffer, ByteOrder::Little);
+}
+
+void TGAHeader::write(std::ostream& stream) const
+{
+    char buffer[TGA_HEADER_SIZE];
+    TGAHeaderLayout::write(*this, buffer, ByteOrder::Little);
+    stream.write(buffer, sizeof(buffer));
+}
+
+// Reads a pixel in file order (B, G, R, A) and returns it as R, G, B, A
+static void read_pixel(std::istream& stream, size_t pixel_size, uint8_t* dest)
+{
+    char pixel[4];
+    stream.read(pixel, pixel_size);
+    dest[0] = static_cast<uint8_t>(pixel[2]);
+    dest[1] = static_cast<uint8_t>(pixel[1]);
+    dest[2] = static_cast<uint8_t>(pixel[0]);
+    dest[3] = (pixel_size == 4) ? static_cast<uint8_t>(pixel[3]) : 0xFF;
+}
+
+Image read_tga(std::istream& stream)
+{
+    TGAHeader header;
+    header.read(stream);
+    if (header.image_type != TGA_TYPE_TRUECOLOR && header.image_type != TGA_TYPE_TRUECOLOR_RLE) {
+        throw field_error("image_type", std::to_string(header.image_type));
+    }
+    if (header.bits_per_pixel != 24 && header.bits_per_pixel != 32) {
+        throw field_error("bits_per_pixel", std::to_string(header.bits_per_pixel));
+    }
+
+    // Skip the image ID and the color map, true color images don't use it
+    size_t colormap_size = 0;
+    if (header.colormap_type != 0) {
+        colormap_size = header.colormap_length * ((header.colormap_depth + 7u) / 8);
+    }
+    stream.ignore(header.id_length + colormap_size);
+
+    Image image;
+    image.width = header.width;
+    image.height = header.height;
+    size_t pixel_count = static_cast<size_t>(image.width) * image.height;
+    size_t pixel_size = header.bits_per_pixel / 8;
+    image.pixels.resize(pixel_count * 4);
+    uint8_t* pixels = image.pixels.data();
+
+    if (header.image_type == TGA_TYPE_TRUECOLOR) {
+        for (size_t pixel_i = 0; pixel_i < pixel_count; pixel_i++) {
+            read_pixel(stream, pixel_size, pixels + pixel_i * 4);
+        }
+    } else {
+        // Packets of up to 128 pixels, either repeating one pixel or raw
+        size_t pixel_i = 0;
+        while (pixel_i < pixel_count) {
+            uint8_t packet = static_cast<uint8_t>(stream.get());
+            size_t count = std::min<size_t>((packet & 0x7F) + 1u, pixel_count - pixel_i);
+            if (packet & 0x80) {
+                read_pixel(stream, pixel_size, pixels + pixel_i * 4);
+                for (size_t repeat_i = 1; repeat_i < count; repeat_i++) {
+                    memcpy(pixels + (pixel_i + repeat_i) * 4, pixels + pixel_i * 4, 4);
+                }
+            } else {
+                for (size_t raw_i = 0; raw_i < count; raw_i++) {
+                    read_pixel(stream, pixel_size, pixels + (pixel_i + raw_i) * 4);
+                }
+            }
+            pixel_i += count;
+        }
+    }
+
+    // Images start at the bottom left corner unless the descriptor says otherwise
+
+    size_t row_size = static_cast<size_t>(image.width) * 4;
+    if (!(header.descriptor & TGA_DESC_TOP_TO_BOTTOM)) {
+        for (uint32_t y = 0; y < image.height / 2; y++) {
+            std::swap_ranges(pixels + y * row_size, pixels + (y + 1) * row_size,
+                pixels + (image.height - 1 - y) * row_size);
+        }
+    }
+    if (header.descriptor & TGA_DESC_RIGHT_TO_LEFT) {
+        for (uint32_t y = 0; y < image.height; y++) {
+            uint8_t* row = pixels + y * row_size;
+            for (uint32_t x = 0; x < image.width / 2; x++) {
+                std::swap_ranges(row + x * 4, row + x * 4 + 4,
+                    row + (image.width - 1 - x) * 4);
+            }
+        }
+    }
+
+    return image;
+}
+
+void write_tga(std::ostream& stream, const Image& image)
+{
+    TGAHeader header;
+    header.width = static_cast<uint16_t>(image.width);
+    header.height = static_cast<uint16_t>(image.height);
+    header.write(stream);
+
+    // Pixels are stored as B, G, R, A
+    size_t row_size = static_cast<size_t>(image.width) * 4;
+    std::vector<char> row(row_size);
+    for (uint32_t y = 0; y < image.height; y++) {
+        const uint8_t* src = image.pixels.data() + y * row_size;
+        for (size_t x = 0; x < row_size; x += 4) {
+            row[x] = static_cast<char>(src[x + 2]);
+            row[x + 1] = static_cast<char>(src[x + 1]);
+            row[x + 2] = static_cast<char>(src[x]);
+            row[x + 3] = static_cast<char>(src[x + 3]);
+        }
+        stream.write(row.data(), row_size);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <iostream>
+
+struct Image;
+
+const size_t TGA_HEADER_SIZE = 18;
+
+// Image types
+const uint8_t TGA_TYPE_TRUECOLOR = 2;
+const uint8_t TGA_TYPE_TRUECOLOR_RLE = 10;
+
+// Descriptor flags, the low 4 bits are the number of alpha bits
+const uint8_t TGA_DESC_RIGHT_TO_LEFT = 0x10;
+const uint8_t TGA_DESC_TOP_TO_BOTTOM = 0x20;
+
+struct TGAHeader
+{
+    void read(std::istream& stream);
+    void write(std::ostream& stream) const;
+
+    uint8_t id_length = 0; // Length of the image ID after the header
+    uint8_t colormap_type = 0;
+    uint8_t image_type = TGA_TYPE_TRUECOLOR;
+    uint16_t colormap_first = 0;
+    uint16_t colormap_length = 0;
+    uint8_t colormap_depth = 0;
+    uint16_t x_origin = 0;
+    uint16_t y_origin = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint8_t bits_per_pixel = 32;
+    uint8_t descriptor = 8 | TGA_DESC_TOP_TO_BOTTOM;
+};
+
+// Reads a 24 or 32 bit true color TGA file, compressed or not
+Image read_tga(std::istream& stream);
+// Writes an uncompressed 32 bit TGA file
+void write_tga(std::ostream& stream, const Image& image);
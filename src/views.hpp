@@ -0,0 +1,66 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <string.h> // memcmp, strlen
+
+// Non-owning views for code that links the library and doesn't want to copy
+// names or texture data. They are only valid as long as the memory they
+// point into, usually a header buffer or a mapped data file.
+
+class StringView
+{
+public:
+    StringView() = default;
+    StringView(const char* data, size_t size) : m_data(data), m_size(size) {}
+    StringView(const char* str) : m_data(str), m_size(strlen(str)) {}
+    StringView(const std::string& str) : m_data(str.data()), m_size(str.size()) {}
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const char* begin() const { return m_data; }
+    const char* end() const { return m_data + m_size; }
+    char operator[](size_t index) const { return m_data[index]; }
+    std::string str() const { return std::string(m_data, m_size); }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+inline bool operator==(StringView a, StringView b)
+{
+    return a.size() == b.size() && (a.size() == 0 || memcmp(a.data(), b.data(), a.size()) == 0);
+}
+
+inline bool operator!=(StringView a, StringView b)
+{
+    return !(a == b);
+}
+
+class ByteView
+{
+public:
+    ByteView() = default;
+    ByteView(const char* data, size_t size) : m_data(data), m_size(size) {}
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const char* begin() const { return m_data; }
+    const char* end() const { return m_data + m_size; }
+    char operator[](size_t index) const { return m_data[index]; }
+
+    // Returns an empty view if the range isn't inside this one
+    ByteView subview(size_t offset, size_t size) const
+    {
+        if (offset > m_size || size > m_size - offset) {
+            return ByteView();
+        }
+        return ByteView(m_data + offset, size);
+    }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};